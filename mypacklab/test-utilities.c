@@ -103,6 +103,191 @@ int example_test(void) {
 }
 
 
+int test_generate_keystream(void) {
+  // XORing with the keystream must match decrypt_data(), including an odd tail
+  uint8_t input_data[] = {0x10, 0x32, 0x54, 0x76, 0x98, 0xBA, 0xDC};
+  uint8_t decrypted[sizeof(input_data)];
+  uint8_t keystream[sizeof(input_data)];
+
+  decrypt_data(input_data, sizeof(input_data), decrypted, sizeof(decrypted), 0x1337);
+  generate_keystream(0x1337, keystream, sizeof(keystream));
+
+  for (size_t i = 0; i < sizeof(input_data); i++) {
+    if ((input_data[i] ^ keystream[i]) != decrypted[i]) {
+      printf("ERROR: keystream byte %lu does not match decrypt_data\n", i);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int test_parse_header_planar(void) {
+  // checksummed byte plane header: plane 3 of 8 byte elements
+  uint8_t header[] = {
+    0x02, 0x13, 0x03, 0x22,
+    0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xAB, 0xCD,
+    0x08, 0x03,
+  };
+
+  packlab_config_t config = {0};
+  parse_header(header, sizeof(header), &config);
+  if (!config.is_valid || !config.is_planar || !config.is_checksummed ||
+      config.checksum_value != 0xABCD || config.element_width != 8 ||
+      config.plane_index != 3 || config.header_len != sizeof(header)) {
+    return 1;
+  }
+
+  // a plane index past the element width is rejected
+  header[23] = 0x08;
+  memset(&config, 0, sizeof(config));
+  parse_header(header, sizeof(header), &config);
+  if (config.is_valid) {
+    return 1;
+  }
+
+  return 0;
+}
+
+int test_join_byte_planes(void) {
+  // 8 byte elements exercise the word transpose and the leftover tail,
+  // 3 byte elements exercise the generic path, and 16 byte elements
+  // are the widest a pack can hold
+  size_t widths[] = {8, 3, MAX_PLANE_WIDTH};
+  size_t num_elements = 19;
+
+  for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+    size_t width = widths[w];
+    uint8_t expected[MAX_PLANE_WIDTH * 19];
+    uint8_t output[MAX_PLANE_WIDTH * 19];
+    uint8_t plane_data[MAX_PLANE_WIDTH][19];
+    uint8_t* planes[MAX_PLANE_WIDTH];
+
+    for (size_t k = 0; k < num_elements; k++) {
+      for (size_t p = 0; p < width; p++) {
+        expected[k * width + p] = (uint8_t)(k * 13 + p * 7 + 1);
+        plane_data[p][k] = expected[k * width + p];
+      }
+    }
+    for (size_t p = 0; p < width; p++) {
+      planes[p] = plane_data[p];
+    }
+
+    memset(output, 0, sizeof(output));
+    join_byte_planes(planes, width, num_elements, output, width * num_elements);
+    if (memcmp(output, expected, width * num_elements) != 0) {
+      printf("ERROR: byte planes of width %lu joined incorrectly\n", width);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int test_join_float_array_with_transform(void) {
+  // slowly varying floats, as a sensor would produce
+  // 11 of them, so the prediction carries across blocks and into a leftover tail
+  float values[] = {1.0f, 1.0625f, 1.125f, 1.25f, -3.0f, -2.9375f, 0.0f, 100.5f,
+                    100.25f, -0.5f, 7.0f};
+  size_t n = sizeof(values) / sizeof(values[0]);
+  uint8_t transforms[] = {TRANSFORM_XOR, TRANSFORM_DELTA};
+
+  for (size_t t = 0; t < sizeof(transforms) / sizeof(transforms[0]); t++) {
+    uint8_t signfrac[3 * 11];
+    uint8_t exp[11];
+    uint8_t output[4 * 11];
+
+    // apply the transform and split, as the packer does
+    uint32_t prev = 0;
+    for (size_t i = 0; i < n; i++) {
+      uint32_t bits;
+      memcpy(&bits, &values[i], 4);
+      uint32_t coded = (transforms[t] == TRANSFORM_XOR) ? (bits ^ prev) : (bits - prev);
+      prev = bits;
+
+      signfrac[i * 3]     = coded & 0xFF;
+      signfrac[i * 3 + 1] = (coded >> 8) & 0xFF;
+      signfrac[i * 3 + 2] = ((coded >> 16) & 0x7F) | ((coded >> 24) & 0x80);
+      exp[i]              = (coded >> 23) & 0xFF;
+    }
+
+    memset(output, 0, sizeof(output));
+    join_float_array_with_transform(signfrac, 3 * n, exp, n, output, 4 * n, transforms[t]);
+    if (memcmp(output, values, 4 * n) != 0) {
+      printf("ERROR: transform %u was not undone by the fused join\n", transforms[t]);
+      return 1;
+    }
+
+    // the standalone inverse must agree with the fused one
+    join_float_array(signfrac, 3 * n, exp, n, output, 4 * n);
+    untransform_float_array(output, 4 * n, transforms[t]);
+    if (memcmp(output, values, 4 * n) != 0) {
+      printf("ERROR: transform %u was not undone in place\n", transforms[t]);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int test_join_float_array_short_stream(void) {
+  // a sign|fraction stream shorter than 3 bytes per exponent byte must be
+  // rejected without touching the output, which unpack relies on to zero it
+  uint8_t signfrac[3 * 4 - 3] = {0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99};
+  uint8_t exp[4] = {0x7F, 0x80, 0x81, 0x82};
+  uint8_t output[4 * 4];
+  uint8_t zeros[4 * 4] = {0};
+
+  memset(output, 0, sizeof(output));
+  join_float_array(signfrac, sizeof(signfrac), exp, sizeof(exp), output, sizeof(output));
+  if (memcmp(output, zeros, sizeof(output)) != 0) {
+    printf("ERROR: join_float_array wrote output for a short stream\n");
+    return 1;
+  }
+
+  join_float_array_with_transform(signfrac, sizeof(signfrac), exp, sizeof(exp),
+                                  output, sizeof(output), TRANSFORM_NONE);
+  if (memcmp(output, zeros, sizeof(output)) != 0) {
+    printf("ERROR: join_float_array_with_transform wrote output for a short stream\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+int test_transform_is_supported(void) {
+  // only whole floats rebuilt from split streams can be untransformed
+  if (!transform_is_supported(TRANSFORM_XOR, false, 2) ||
+      !transform_is_supported(TRANSFORM_NONE, false, 1) ||
+      !transform_is_supported(TRANSFORM_NONE, true, 2)) {
+    return 1;
+  }
+
+  // a single float stream is copied out as is
+  if (transform_is_supported(TRANSFORM_XOR, false, 1) ||
+      transform_is_supported(TRANSFORM_DELTA, false, 1)) {
+    printf("ERROR: transform accepted on a single stream\n");
+    return 1;
+  }
+
+  // the 3 stream join is still the extra credit stub
+  if (transform_is_supported(TRANSFORM_XOR, false, 3)) {
+    printf("ERROR: transform accepted on 3 stream floats\n");
+    return 1;
+  }
+
+  // byte planes are joined without rebuilding floats
+  if (transform_is_supported(TRANSFORM_XOR, true, 2) ||
+      transform_is_supported(TRANSFORM_DELTA, true, 4)) {
+    printf("ERROR: transform accepted on byte planes\n");
+    return 1;
+  }
+
+  return 0;
+}
+
 
 int main(void) {
 
@@ -126,6 +311,42 @@ int main(void) {
     return 1;
   }
 
+  result = test_generate_keystream();
+  if (result != 0) {
+    printf("ERROR: test_generate_keystream failed\n");
+    return 1;
+  }
+
+  result = test_parse_header_planar();
+  if (result != 0) {
+    printf("ERROR: test_parse_header_planar failed\n");
+    return 1;
+  }
+
+  result = test_join_byte_planes();
+  if (result != 0) {
+    printf("ERROR: test_join_byte_planes failed\n");
+    return 1;
+  }
+
+  result = test_join_float_array_with_transform();
+  if (result != 0) {
+    printf("ERROR: test_join_float_array_with_transform failed\n");
+    return 1;
+  }
+
+  result = test_join_float_array_short_stream();
+  if (result != 0) {
+    printf("ERROR: test_join_float_array_short_stream failed\n");
+    return 1;
+  }
+
+  result = test_transform_is_supported();
+  if (result != 0) {
+    printf("ERROR: test_transform_is_supported failed\n");
+    return 1;
+  }
+
   printf("All tests passed successfully!\n");
   return 0;
 }
@@ -7,6 +7,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "unpack-utilities.h"
 
 
@@ -64,6 +68,12 @@ void parse_header(uint8_t* input_data, size_t input_len, packlab_config_t* confi
   flags = flags << 1;
 
   if (flags >= 0x80) config->should_float3 = true; // float3 data?
+  flags = flags << 1;
+
+  if (flags >= 0x80) config->is_planar = true; // byte plane data?
+  flags = flags << 1;
+
+  bool is_transformed = (flags >= 0x80); // predictive transform?
 
   // now onto byte 5-12 or indexes 4-11 for the length in bytes
   uint64_t originalLength = 0;
@@ -109,6 +119,40 @@ void parse_header(uint8_t* input_data, size_t input_len, packlab_config_t* confi
     config->checksum_value = config->checksum_value + input_data[dataIndexer + 1];
     dataIndexer += 2;
   }
+
+  if (config->is_planar) // deals with byte planes
+  {
+    if (input_len < dataIndexer + 2) // check input len
+    {
+      config->is_valid = false;
+      return;
+    }
+    config->element_width = input_data[dataIndexer];
+    config->plane_index = input_data[dataIndexer + 1];
+    if (config->element_width == 0 || config->element_width > MAX_PLANE_WIDTH ||
+        config->plane_index >= config->element_width)
+    {
+      config->is_valid = false;
+      return;
+    }
+    dataIndexer += 2;
+  }
+
+  if (is_transformed) // deals with predictive transforms
+  {
+    if (input_len < dataIndexer + 1) // check input len
+    {
+      config->is_valid = false;
+      return;
+    }
+    config->transform = input_data[dataIndexer];
+    if (config->transform != TRANSFORM_XOR && config->transform != TRANSFORM_DELTA)
+    {
+      config->is_valid = false;
+      return;
+    }
+    dataIndexer += 1;
+  }
   config->header_len = dataIndexer;
   return;
 
@@ -189,6 +233,23 @@ void decrypt_data(uint8_t* input_data, size_t input_len,
   
 }
 
+void generate_keystream(uint16_t encryption_key, uint8_t* keystream, size_t len) {
+
+  // Same LFSR sequence as decrypt_data(), without the data
+  uint16_t lfsr_state = lfsr_step(encryption_key);
+
+  size_t i = 0;
+  for (i = 0; i + 1 < len; i += 2) {
+    keystream[i] = lfsr_state & 0xFF;
+    keystream[i+1] = lfsr_state >> 8;
+    lfsr_state = lfsr_step(lfsr_state);
+  }
+
+  if (i < len) {
+    keystream[i] = lfsr_state & 0xFF;
+  }
+}
+
 size_t decompress_data(uint8_t* input_data, size_t input_len,
                       uint8_t* output_data, size_t output_len,
                       uint8_t* dictionary_data) {
@@ -241,6 +302,23 @@ size_t decompress_data(uint8_t* input_data, size_t input_len,
   return output_index;
 }
 
+// Builds the bits of one float from its 3 sign|fraction bytes and exponent byte
+// The sign is the top bit of signfrac_byte2, the fraction is the remaining 23 bits
+static uint32_t join_float_bits(uint8_t signfrac_byte0, uint8_t signfrac_byte1,
+                                uint8_t signfrac_byte2, uint8_t exp_byte) {
+  uint32_t sign = signfrac_byte2 >> 7;
+  uint32_t frac = ((uint32_t)(signfrac_byte2 & 0x7F) << 16) | ((uint32_t)signfrac_byte1 << 8) | signfrac_byte0;
+  return (sign << 31) | ((uint32_t)exp_byte << 23) | frac;
+}
+
+// Writes the bits of one float in little-endian order
+static void write_float_bits(uint8_t* output, uint32_t bits) {
+  output[0] = bits & 0xFF;
+  output[1] = (bits >> 8) & 0xFF;
+  output[2] = (bits >> 16) & 0xFF;
+  output[3] = bits >> 24;
+}
+
 void join_float_array(uint8_t* input_signfrac, size_t input_len_bytes_signfrac,
                       uint8_t* input_exp, size_t input_len_bytes_exp,
                       uint8_t* output_data, size_t output_len_bytes) {
@@ -261,7 +339,7 @@ void join_float_array(uint8_t* input_signfrac, size_t input_len_bytes_signfrac,
   // Iterate over each floating-point number
   for (size_t i = 0; i < num_floats; i++) {
     // ensure not over limit
-    if (i * 4 > output_len_bytes) break;
+    if ((i + 1) * 4 > output_len_bytes) break;
 
     // Extract sign and mantissa from signfrac stream
     uint8_t signfrac_byte0 = input_signfrac[i * 3];
@@ -272,21 +350,178 @@ void join_float_array(uint8_t* input_signfrac, size_t input_len_bytes_signfrac,
     uint8_t exp_byte = input_exp[i];
 
     // Combine sign, exponent, and mantissa into a 32-bit floating-point number
-    uint8_t signExp = ((signfrac_byte2 >> 7) << 7) + (exp_byte >> 1);
-    uint8_t expMantissa = ((exp_byte) << 7) + ((signfrac_byte2 << 1) >> 1);
-  
-    uint8_t midMantissa = signfrac_byte1;
-    uint8_t endMantissa = signfrac_byte0;
+    uint32_t bits = join_float_bits(signfrac_byte0, signfrac_byte1, signfrac_byte2, exp_byte);
 
     // Write the 32-bit floating-point number to the output buffer in little-endian order
-    output_data[i * 4] = endMantissa;
-    output_data[i * 4 + 1] = midMantissa;
-    output_data[i * 4 + 2] = expMantissa;
-    output_data[i * 4 + 3] = signExp;
+    write_float_bits(&output_data[i * 4], bits);
+  }
+
+
+}
+
+#if defined(__SSE2__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define HAVE_BLOCKED_SCAN 1
+
+// Prefix XOR or prefix sum across the four 32-bit lanes of v, continued from carry
+// Two shifted combines cover the block, so a block costs one dependent step on
+// the previous block instead of four
+static __m128i scan_4_words(__m128i v, __m128i carry, uint8_t transform) {
+  if (transform == TRANSFORM_XOR) {
+    v = _mm_xor_si128(v, _mm_slli_si128(v, 4));
+    v = _mm_xor_si128(v, _mm_slli_si128(v, 8));
+    return _mm_xor_si128(v, carry);
   }
+  v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+  v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+  return _mm_add_epi32(v, carry);
+}
+#endif
+
+void join_float_array_with_transform(uint8_t* input_signfrac, size_t input_len_bytes_signfrac,
+                                     uint8_t* input_exp, size_t input_len_bytes_exp,
+                                     uint8_t* output_data, size_t output_len_bytes,
+                                     uint8_t transform) {
+
+  // Same as join_float_array(), but the running prediction is carried in a
+  // register so the inverse transform costs no extra pass over memory
+  size_t num_floats = input_len_bytes_signfrac / 3;
+  if (input_len_bytes_signfrac % 3 != 0 || input_len_bytes_exp != num_floats) {
+    return;
+  }
+  if (num_floats > output_len_bytes / 4) {
+    num_floats = output_len_bytes / 4;
+  }
+
+  uint32_t prev = 0;
+  size_t i = 0;
+
+#ifdef HAVE_BLOCKED_SCAN
+  // Four floats at a time: build them, then scan the block as a vector
+  if (transform != TRANSFORM_NONE) {
+    __m128i carry = _mm_setzero_si128();
+    for (; i + 4 <= num_floats; i += 4) {
+      uint32_t words[4];
+      for (int j = 0; j < 4; j++) {
+        const uint8_t* sf = &input_signfrac[(i + j) * 3];
+        words[j] = join_float_bits(sf[0], sf[1], sf[2], input_exp[i + j]);
+      }
+      __m128i v;
+      memcpy(&v, words, sizeof(v));
+      v = scan_4_words(v, carry, transform);
+      memcpy(&output_data[i * 4], &v, sizeof(v));
+      carry = _mm_shuffle_epi32(v, 0xFF);
+    }
+    prev = (uint32_t)_mm_cvtsi128_si32(carry);
+  }
+#endif
+
+  // Scalar for the tail, or everything without the vector scan
+  for (; i < num_floats; i++) {
+    uint32_t bits = join_float_bits(input_signfrac[i * 3], input_signfrac[i * 3 + 1],
+                                    input_signfrac[i * 3 + 2], input_exp[i]);
+    if (transform == TRANSFORM_XOR) {
+      bits ^= prev;
+    } else if (transform == TRANSFORM_DELTA) {
+      bits += prev;
+    }
+    prev = bits;
+    write_float_bits(&output_data[i * 4], bits);
+  }
+}
+
+void untransform_float_array(uint8_t* data, size_t len_bytes, uint8_t transform) {
+
+  // Prefix XOR or prefix sum over the 32-bit words
+  if (transform == TRANSFORM_NONE) {
+    return;
+  }
+
+  uint32_t prev = 0;
+  size_t i = 0;
+
+#ifdef HAVE_BLOCKED_SCAN
+  __m128i carry = _mm_setzero_si128();
+  for (; i + 16 <= len_bytes; i += 16) {
+    __m128i v;
+    memcpy(&v, &data[i], sizeof(v));
+    v = scan_4_words(v, carry, transform);
+    memcpy(&data[i], &v, sizeof(v));
+    carry = _mm_shuffle_epi32(v, 0xFF);
+  }
+  prev = (uint32_t)_mm_cvtsi128_si32(carry);
+#endif
+
+  for (; i + 4 <= len_bytes; i += 4) {
+    uint32_t bits = (uint32_t)data[i] | ((uint32_t)data[i + 1] << 8) |
+                    ((uint32_t)data[i + 2] << 16) | ((uint32_t)data[i + 3] << 24);
+    if (transform == TRANSFORM_XOR) {
+      bits ^= prev;
+    } else {
+      bits += prev;
+    }
+    prev = bits;
+    write_float_bits(&data[i], bits);
+  }
+}
+
+bool transform_is_supported(uint8_t transform, bool is_planar, size_t num_streams) {
+
+  // Only the split float formats rebuild whole floats to undo a transform on
+  if (transform == TRANSFORM_NONE) {
+    return true;
+  }
+  return !is_planar && num_streams == 2;
+}
+
+// Transposes an 8x8 block of bytes held as eight little-endian words
+// Byte j of rows[i] ends up as byte i of rows[j]
+static void transpose_8x8_bytes(uint64_t rows[8]) {
+  // Swap 4x4 blocks, then 2x2 blocks, then single bytes
+  const uint64_t masks[3] = {0x00000000FFFFFFFFULL, 0x0000FFFF0000FFFFULL, 0x00FF00FF00FF00FFULL};
+  for (int d = 4, level = 0; d >= 1; d /= 2, level++) {
+    for (int i = 0; i < 8; i++) {
+      if (i & d) continue;
+      uint64_t t = ((rows[i] >> (8 * d)) ^ rows[i + d]) & masks[level];
+      rows[i]     ^= t << (8 * d);
+      rows[i + d] ^= t;
+    }
+  }
+}
 
+void join_byte_planes(uint8_t* planes[], size_t num_planes, size_t plane_len,
+                      uint8_t* output_data, size_t output_len_bytes) {
+
+  // Interleave the planes back into elements
+  // Each plane holds one byte position of every element
+  if (num_planes == 0 || output_len_bytes < num_planes * plane_len) {
+    return;
+  }
+
+  size_t k = 0;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  // 8-byte elements (doubles, 64-bit integers) are transposed 8 elements at a
+  // time inside 64-bit registers instead of one byte at a time
+  if (num_planes == 8) {
+    for (; k + 8 <= plane_len; k += 8) {
+      uint64_t rows[8];
+      for (int p = 0; p < 8; p++) {
+        memcpy(&rows[p], &planes[p][k], 8);
+      }
+      transpose_8x8_bytes(rows);
+      memcpy(&output_data[k * 8], rows, sizeof(rows));
+    }
+  }
+#endif
 
+  // Everything else (and the tail of the above) goes element by element
+  for (; k < plane_len; k++) {
+    for (size_t p = 0; p < num_planes; p++) {
+      output_data[k * num_planes + p] = planes[p][k];
+    }
+  }
 }
+
 /* End of mandatory implementation. */
 
 /* Extra credit */
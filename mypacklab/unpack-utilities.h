@@ -8,12 +8,19 @@
 #include <stdlib.h>
 
 // Definitions
-#define MAX_HEADER_SIZE (4 + 8 + 8 + 16 + 2)
+#define MAX_HEADER_SIZE (4 + 8 + 8 + 16 + 2 + 2 + 1)
 #define HEADER_ALIGN    4096
 #define DATA_ALIGN      4096
 #define DICTIONARY_LENGTH 16
 #define ESCAPE_BYTE 0x07
 #define MAX_RUN_LENGTH 16
+#define MAX_PLANE_WIDTH 16
+
+// Predictive transforms applied to each 32-bit float before it was split
+// The packed value is the float's bits XORed with, or minus, the previous float's bits
+#define TRANSFORM_NONE  0
+#define TRANSFORM_XOR   1
+#define TRANSFORM_DELTA 2
 
 
 // Struct to hold header configuration data
@@ -52,6 +59,21 @@ typedef struct {
   // whether floating point is being handled with 3 streams instead of 2
   bool should_float3;
 
+  // whether this stream is one byte plane of an array of fixed-width elements
+  bool is_planar;
+
+  // width in bytes of each element, which is also the number of plane streams
+  // (only valid if is_planar is true)
+  uint8_t element_width;
+
+  // which byte of each little-endian element this stream holds
+  // (only valid if is_planar is true)
+  uint8_t plane_index;
+
+  // predictive transform applied to the floats before packing (TRANSFORM_*)
+  // TRANSFORM_NONE unless the header has the transform flag set
+  uint8_t transform;
+
   // the size of data originally packed into this stream, in bytes
   uint64_t orig_data_size;
 
@@ -92,6 +114,11 @@ void decrypt_data(uint8_t* input_data, size_t input_len,
                   uint8_t* output_data, size_t output_len,
                   uint16_t encryption_key);
 
+// Writes the bytes that decrypt_data() XORs with the data into `keystream`
+// decrypting is then input_data[i] ^ keystream[i], so one keystream can be
+// generated once per key and reused for every stream
+void generate_keystream(uint16_t encryption_key, uint8_t* keystream, size_t len);
+
 // Calculates a 16-bit checksum value over input data
 uint16_t calculate_checksum(uint8_t* input_data, size_t input_len);
 
@@ -107,6 +134,30 @@ void join_float_array(uint8_t* input_signfrac, size_t input_len_bytes_signfrac,
                       uint8_t* output_data, size_t output_len_bytes);
 
 
+// join_float_array(), then undo a predictive transform (TRANSFORM_*) in the same pass
+// each output float is rebuilt from its bytes and then combined with the previous output float
+void join_float_array_with_transform(uint8_t* input_signfrac, size_t input_len_bytes_signfrac,
+                                     uint8_t* input_exp, size_t input_len_bytes_exp,
+                                     uint8_t* output_data, size_t output_len_bytes,
+                                     uint8_t transform);
+
+// undo a predictive transform (TRANSFORM_*) in place over an array of 32 bit little-endian floats
+// for outputs that were joined without one
+void untransform_float_array(uint8_t* data, size_t len_bytes, uint8_t transform);
+
+// whether a predictive transform (TRANSFORM_*) can be undone for a pack of num_streams streams
+// transforms apply to whole floats, so single stream and byte plane packs never qualify;
+// neither does the 3 stream format until join_float_array_three_stream() is implemented
+bool transform_is_supported(uint8_t transform, bool is_planar, size_t num_streams);
+
+// join byte planes to create a single stream of fixed-width elements
+// plane p holds byte p (little-endian order) of every element, so
+// element k of the output is planes[0][k], planes[1][k], ... planes[num_planes-1][k]
+// every plane must be plane_len bytes long
+// output_len_bytes must be >= num_planes*plane_len
+void join_byte_planes(uint8_t* planes[], size_t num_planes, size_t plane_len,
+                      uint8_t* output_data, size_t output_len_bytes);
+
 
 // For Extra Credit:
 // join 3 streams to create a single stream of 32 bit IEEE floats
@@ -1,12 +1,20 @@
 // Application to unpack files
 // PackLab - CS213 - Northwestern University
 
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "unpack-utilities.h"
 
@@ -14,12 +22,38 @@
 #define MAX_STREAMS 16
 #define ROUNDUP_ALIGN(N, A) ((A)*(((N) / (A)) + (!!((N) % (A)))))
 
+#define PARALLEL_WRITE_MIN (8 << 20) // outputs smaller than this are written by one thread
+#define MAX_WRITERS        16        // most threads rebuilding and writing the output
+#define SEGMENT_ELEMENTS   4096      // output segments start on multiples of this many elements
+
+// How the reconstructed streams combine into the output
+#define LAYOUT_COPY   0  // single stream, written as is
+#define LAYOUT_PLANES 1  // byte planes, joined per segment
+#define LAYOUT_FLOAT2 2  // 2 stream floats, joined per segment
+#define LAYOUT_DONE   3  // already joined front to back into final_output_data
+
+// One contiguous piece of the output file, rebuilt and written by one thread
+typedef struct {
+  int output_fd;
+  int layout;
+  uint8_t** output_data;      // reconstructed streams
+  uint64_t num_streams;
+  uint8_t* final_output_data;
+  uint64_t element_size;      // output bytes per element
+  uint64_t first_element;
+  uint64_t num_elements;
+  bool failed;
+} output_segment_t;
+
 
 static int analyze_streams(uint8_t* buf, uint64_t len, uint64_t* nums, uint64_t* offsets, uint64_t* orig_sizes,
                            uint64_t* stored_sizes) {
   uint64_t curoff = 0;
   packlab_config_t config;
 
+  bool planar = false;
+  uint8_t width = 0;
+
   uint64_t maxnums = *nums;
   for (uint64_t i = 0; i < maxnums; i++) {
     memset(&config, 0, sizeof(config));
@@ -29,6 +63,18 @@ static int analyze_streams(uint8_t* buf, uint64_t len, uint64_t* nums, uint64_t*
       return -1;
     }
 
+    // byte plane streams must all agree on the element width and
+    // appear in plane order
+    if (i == 0) {
+      planar = config.is_planar;
+      width  = config.element_width;
+    }
+    if (config.is_planar != planar ||
+        (planar && (config.element_width != width || config.plane_index != i))) {
+      fprintf(stderr, "stream %lu is not the expected byte plane\n", i);
+      return -1;
+    }
+
     orig_sizes[i]   = config.orig_data_size;
     stored_sizes[i] = config.data_size;
     offsets[i]      = curoff;
@@ -37,7 +83,20 @@ static int analyze_streams(uint8_t* buf, uint64_t len, uint64_t* nums, uint64_t*
       *nums = i + 1;
 
       // check for the specific cases we will support
-      if (*nums == 1) {
+      if (planar) {
+        // one stream per byte of the element, all of the same length
+        if (*nums != width) {
+          fprintf(stderr, "%lu byte planes for %u byte elements\n", *nums, width);
+          return -1;
+        }
+        for (uint64_t k = 1; k < *nums; k++) {
+          if (orig_sizes[k] != orig_sizes[0]) {
+            fprintf(stderr, "byte planes have different lengths\n");
+            return -1;
+          }
+        }
+        return 0;
+      } else if (*nums == 1) {
         // generic raw format, anything goes
         return 0;
       } else if (*nums == 2) {
@@ -57,13 +116,13 @@ static int analyze_streams(uint8_t* buf, uint64_t len, uint64_t* nums, uint64_t*
           return -1;
         }
       } else {
-        fprintf(stderr, "number of streams is not 1, 2 (FP), or 3 (FP3)\n");
+        fprintf(stderr, "number of streams is not 1, 2 (FP), 3 (FP3), or planar\n");
         return -1;
       }
     }
 
-    if (!config.should_float) {
-      fprintf(stderr, "continuation outside of float is currently unsupported\n");
+    if (!config.should_float && !config.is_planar) {
+      fprintf(stderr, "continuation outside of float or byte planes is currently unsupported\n");
       return -1;
     }
 
@@ -87,15 +146,240 @@ static int analyze_streams(uint8_t* buf, uint64_t len, uint64_t* nums, uint64_t*
   return -1;
 }
 
-int main(int argc, char* argv[]) {
-  // Parse app flags
-  // No flags for unpack, just input and output filenames
-  if (argc != 3) {
-    printf("usage: %s inputfilename outputfilename\n", argv[0]);
-    error_and_exit("\n");
+// Moves `len` bytes starting at `offset` in input_fd to the start of output_fd
+// Prefers copy_file_range (no copy through user space at all), then sendfile,
+// then a plain read/write loop for filesystems that support neither
+static int copy_file_region(int input_fd, uint64_t offset, int output_fd, uint64_t len) {
+  loff_t in_off = offset;
+  uint64_t left = len;
+
+  while (left > 0) {
+    ssize_t copied = copy_file_range(input_fd, &in_off, output_fd, NULL, left, 0);
+    if (copied <= 0) {
+      if (copied < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+        break;
+      }
+      return -1;
+    }
+    left -= copied;
+  }
+
+  off_t send_off = in_off;
+  while (left > 0) {
+    ssize_t copied = sendfile(output_fd, input_fd, &send_off, left);
+    if (copied <= 0) {
+      if (copied < 0 && (errno == ENOSYS || errno == EINVAL)) {
+        break;
+      }
+      return -1;
+    }
+    left -= copied;
+  }
+
+  uint8_t buf[1 << 16];
+  uint64_t read_off = send_off;
+  while (left > 0) {
+    size_t chunk = left < sizeof(buf) ? left : sizeof(buf);
+    ssize_t got = pread(input_fd, buf, chunk, read_off);
+    if (got <= 0) {
+      return -1;
+    }
+    for (ssize_t done = 0; done < got; ) {
+      ssize_t wrote = write(output_fd, buf + done, got - done);
+      if (wrote <= 0) {
+        return -1;
+      }
+      done += wrote;
+    }
+    read_off += got;
+    left     -= got;
+  }
+
+  return 0;
+}
+
+// Writes all of `len` bytes at `offset`, retrying short writes
+static int pwrite_all(int fd, const uint8_t* buf, uint64_t len, uint64_t offset) {
+  while (len > 0) {
+    ssize_t wrote = pwrite(fd, buf, len, offset);
+    if (wrote <= 0) {
+      return -1;
+    }
+    buf    += wrote;
+    len    -= wrote;
+    offset += wrote;
+  }
+  return 0;
+}
+
+// Rebuilds one segment of the output from the streams, then writes it
+// Segments do not overlap, so any number of these can run at once
+static void* write_output_segment(void* arg) {
+  output_segment_t* seg = arg;
+  uint64_t first  = seg->first_element;
+  uint64_t count  = seg->num_elements;
+  uint64_t offset = first * seg->element_size;
+  uint64_t len    = count * seg->element_size;
+  uint8_t* source = &seg->final_output_data[offset];
+
+  if (seg->layout == LAYOUT_COPY) {
+    source = &seg->output_data[0][offset];
+  } else if (seg->layout == LAYOUT_PLANES) {
+    uint8_t* planes[MAX_STREAMS];
+    for (uint64_t p = 0; p < seg->num_streams; p++) {
+      planes[p] = &seg->output_data[p][first];
+    }
+    join_byte_planes(planes, seg->num_streams, count, source, len);
+  } else if (seg->layout == LAYOUT_FLOAT2) {
+    join_float_array(&seg->output_data[0][3 * first], 3 * count,
+        &seg->output_data[1][first], count, source, len);
+  }
+
+  seg->failed = (pwrite_all(seg->output_fd, source, len, offset) != 0);
+  return NULL;
+}
+
+// Fast path for a single stream stored verbatim (no compression, encryption, or float split)
+// The data region is moved file-to-file by the kernel, never passing through our buffers
+// Returns 0 if the file was unpacked, or 1 if it needs the general path below
+static int unpack_raw_passthrough(const char* input_filename, uint64_t raw_len, const char* output_filename) {
+  int input_fd = open(input_filename, O_RDONLY);
+  if (input_fd < 0) {
+    return 1;
+  }
+
+  uint8_t header[MAX_HEADER_SIZE] = {0};
+  size_t header_read = raw_len < MAX_HEADER_SIZE ? raw_len : MAX_HEADER_SIZE;
+  if (pread(input_fd, header, header_read, 0) != (ssize_t)header_read) {
+    close(input_fd);
+    return 1;
+  }
+
+  packlab_config_t config = {0};
+  parse_header(header, header_read, &config);
+
+  uint64_t data_offset = ROUNDUP_ALIGN(config.header_len, DATA_ALIGN);
+  if (!config.is_valid || config.is_compressed || config.is_encrypted || config.should_continue ||
+      config.should_float || config.should_float3 || config.is_planar || config.transform != TRANSFORM_NONE ||
+      config.data_size != config.orig_data_size ||
+      data_offset + config.data_size > raw_len) {
+    // anything unusual (including errors) is left to the general path
+    close(input_fd);
+    return 1;
+  }
+
+  // Checksum straight from a mapping of the input rather than a private copy
+  if (config.is_checksummed) {
+    uint16_t calc_checksum = 0;
+    if (config.data_size > 0) {
+      uint8_t* mapped = mmap(NULL, data_offset + config.data_size, PROT_READ, MAP_PRIVATE, input_fd, 0);
+      if (mapped == MAP_FAILED) {
+        close(input_fd);
+        return 1;
+      }
+      madvise(mapped, data_offset + config.data_size, MADV_SEQUENTIAL);
+      calc_checksum = calculate_checksum(&mapped[data_offset], config.data_size);
+      munmap(mapped, data_offset + config.data_size);
+    }
+    if (calc_checksum != config.checksum_value) {
+      error_and_exit("ERROR: checksum is invalid\n");
+    }
+  }
+
+  // Create output file
+  int output_fd = open(output_filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (output_fd < 0) {
+    error_and_exit("ERROR: could not open output file\n");
+  }
+
+  if (copy_file_region(input_fd, data_offset, output_fd, config.data_size) != 0) {
+    error_and_exit("ERROR: could not write output file data\n");
+  }
+
+  close(output_fd);
+  close(input_fd);
+  return 0;
+}
+
+// Where the decryption key comes from, set by the command line flags
+// The key is derived once per process and shared by every file and stream
+static const char* key_option      = NULL;  // --key 0xNNNN, used as the key directly
+static const char* key_file_option = NULL;  // --key-file path, holds the password
+static int key_fd_option           = -1;    // --key-fd N, a descriptor to read the password from
+
+static bool have_encryption_key = false;
+static uint16_t encryption_key  = 0;
+
+// Keystream for encryption_key, extended as longer streams show up
+static uint8_t* keystream    = NULL;
+static size_t keystream_len  = 0;
+
+// Reads a password (first whitespace separated word) from an open file
+static void read_password(FILE* password_fd, char password[80]) {
+  if (password_fd == NULL || fscanf(password_fd, "%79s", password) != 1) {
+    error_and_exit("ERROR: could not read password from key source\n");
+  }
+}
+
+// Returns the decryption key, deriving it from the first available source
+// on first use: --key, --key-file, --key-fd, PACKLAB_PASSWORD, or a prompt
+static uint16_t get_encryption_key(void) {
+  if (have_encryption_key) {
+    return encryption_key;
   }
-  char* input_filename  = argv[1];
-  char* output_filename = argv[2];
+
+  if (key_option != NULL) {
+    char* end = NULL;
+    unsigned long value = strtoul(key_option, &end, 0);
+    if (end == key_option || *end != '\0' || value > 0xFFFF) {
+      error_and_exit("ERROR: --key must be a 16 bit number such as 0x1337\n");
+    }
+    encryption_key = value;
+  } else {
+    char password[80] = "";
+    if (key_file_option != NULL) {
+      FILE* password_fd = fopen(key_file_option, "r");
+      read_password(password_fd, password);
+      fclose(password_fd);
+    } else if (key_fd_option >= 0) {
+      FILE* password_fd = fdopen(key_fd_option, "r");
+      read_password(password_fd, password);
+      fclose(password_fd);
+    } else if (getenv("PACKLAB_PASSWORD")) {
+      strncpy(password, getenv("PACKLAB_PASSWORD"), sizeof(password) - 1);
+    } else {
+      printf("Type the file password and hit enter: ");
+      int match_count = scanf("%79s", password);
+      if (match_count != 1) {
+        error_and_exit("ERROR: invalid password entered\n");
+      }
+    }
+
+    // Use a checksum as a lazy method for "hashing" the password
+    // This isn't ideal as it will have many collisions (password "ab" equals password "ba")
+    encryption_key = calculate_checksum((uint8_t*)password, strlen(password));
+  }
+
+  have_encryption_key = true;
+  return encryption_key;
+}
+
+// Returns at least `len` bytes of keystream for the decryption key
+// Every stream starts from the same LFSR state, so one keystream serves them all
+static uint8_t* get_keystream(size_t len) {
+  if (len > keystream_len) {
+    size_t new_len = keystream_len * 2 > len ? keystream_len * 2 : len;
+    free(keystream);
+    keystream     = malloc_and_check(new_len);
+    keystream_len = new_len;
+    generate_keystream(get_encryption_key(), keystream, keystream_len);
+  }
+  return keystream;
+}
+
+// Unpacks one packed file into an output file
+// Exits the program on any error
+static void unpack_file(const char* input_filename, const char* output_filename) {
 
   // Validate input data
   if (strcmp(input_filename, output_filename) == 0) {
@@ -117,6 +401,12 @@ int main(int argc, char* argv[]) {
   }
   size_t raw_len = st.st_size;
 
+  // Raw single-stream packs need no processing at all
+  if (unpack_raw_passthrough(input_filename, raw_len, output_filename) == 0) {
+    fclose(input_fd);
+    return;
+  }
+
   // Read entire input file contents
   uint8_t* raw_data = malloc_and_check(raw_len);
   size_t read_len   = fread(raw_data, sizeof(uint8_t), raw_len, input_fd);
@@ -131,9 +421,10 @@ int main(int argc, char* argv[]) {
   //    normal - single stream
   //    f2     - 2 streams, floats, with 8 bit exponent stream and 24 bit sign+mantissa
   //    f3     - 3 streams, floats, with 8 bit exponent stream, 23 bit mantissa stream, 1 bit sign stream
+  //    planar - N streams, one per byte of an N byte element (doubles, 16/32/64 bit integers, structs)
 
   uint64_t num_streams = MAX_STREAMS;
-  uint64_t offsets[MAX_STREAMS];       // byte offset to header of stream k
+  uint64_t offsets[MAX_STREAMS + 1];   // byte offset to header of stream k, then end of file
   uint64_t orig_sizes[MAX_STREAMS];    // size of the original data in streak k
   uint64_t stored_sizes[MAX_STREAMS];  // size of the stored data in streak k
 
@@ -146,7 +437,7 @@ int main(int argc, char* argv[]) {
   // now we will generate our pointers into the input data for each
   // stream, space for storing the output data, and space for the final result
   // this setup is generalized, though the later code will only handle
-  // the 1 stream raw, and 2 or 3 stream float formats
+  // the 1 stream raw, 2 or 3 stream float, and N stream byte plane formats
 
   uint8_t* output_data[num_streams];
   for (uint64_t stream = 0; stream < num_streams; stream++) {
@@ -154,9 +445,20 @@ int main(int argc, char* argv[]) {
     memset(output_data[stream], 0, orig_sizes[stream]);
   }
 
+  // Byte plane packs say so in every header, so the first one is enough
+  packlab_config_t first_config = {0};
+  parse_header(raw_data, raw_len, &first_config);
+  bool planar = first_config.is_planar;
+  uint8_t transform = first_config.transform;
+  if (!transform_is_supported(transform, planar, num_streams)) {
+    error_and_exit("ERROR: have a transform on a pack that is not 2 stream floats\n");
+  }
+
   // FP assumptions here
   uint64_t final_output_size = 0;
-  if (num_streams == 1) {
+  if (planar) {
+    final_output_size = num_streams * orig_sizes[0];
+  } else if (num_streams == 1) {
     final_output_size = orig_sizes[0];
   } else if (num_streams == 2 || num_streams == 3) {
     final_output_size = 4 * orig_sizes[1];  // "exponent stream" size
@@ -164,9 +466,6 @@ int main(int argc, char* argv[]) {
     error_and_exit("ERROR: have too many streams\n");
   }
 
-  uint8_t* final_output_data = malloc_and_check(final_output_size);
-  memset(final_output_data, 0, final_output_size);
-
   // now reconstruct each stream
   for (uint64_t stream = 0; stream < num_streams; stream++) {
     // Create a zero'd out configuration
@@ -184,16 +483,27 @@ int main(int argc, char* argv[]) {
     }
 
     // Check independently if this is sane if it's a continuation
-    if (config.should_continue && !config.should_float) {
+    if (config.should_continue && !config.should_float && !config.is_planar) {
       error_and_exit("ERROR: have non-float continuation\n");
     }
 
-    if (stream == 1 && !config.should_float) {
-      error_and_exit("ERROR: have 2nd stream without float\n");
+    // Predictive transforms apply to whole floats, so every stream must agree
+    if (config.transform != transform || (transform != TRANSFORM_NONE && !config.should_float)) {
+      error_and_exit("ERROR: have inconsistent or non-float transform\n");
     }
 
-    if (stream == 2 && !config.should_float3) {
-      error_and_exit("ERROR: have 3rd stream without float3\n");
+    if (planar) {
+      if (!config.is_planar || config.plane_index != stream) {
+        error_and_exit("ERROR: have byte plane stream out of order\n");
+      }
+    } else {
+      if (stream == 1 && !config.should_float) {
+        error_and_exit("ERROR: have 2nd stream without float\n");
+      }
+
+      if (stream == 2 && !config.should_float3) {
+        error_and_exit("ERROR: have 3rd stream without float3\n");
+      }
     }
 
     // Create a buffer containing the file data only
@@ -222,33 +532,11 @@ int main(int argc, char* argv[]) {
 
     // Handle decryption
     if (config.is_encrypted) {
-      // Get a password from the user, only the first time
-      static char password[80] = "";
-      if (strlen(password) == 0) {
-        if (getenv("PACKLAB_PASSWORD")) {
-          strcpy(password, getenv("PACKLAB_PASSWORD"));
-        } else {
-          printf("Type the file password and hit enter: ");
-          int match_count = scanf("%79s", password);
-          if (match_count != 1) {
-            error_and_exit("ERROR: invalid password entered\n");
-          }
-        }
+      // XOR with the cached keystream, in place since nothing else reads data
+      uint8_t* stream_keys = get_keystream(data_len);
+      for (size_t i = 0; i < data_len; i++) {
+        data[i] ^= stream_keys[i];
       }
-
-      // Use a checksum as a lazy method for "hashing" the password
-      // This isn't ideal as it will have many collisions (password "ab" equals password "ba")
-      uint16_t encryption_key = calculate_checksum((uint8_t*)password, strlen(password));
-
-      // Decrypt the data
-      size_t output_len    = data_len;
-      uint8_t* output_temp = malloc_and_check(output_len);
-      decrypt_data(data, data_len, output_temp, output_len, encryption_key);
-
-      // Replace data with new output
-      free(data);
-      data     = output_temp;
-      data_len = output_len;
     }
 
     // Handle decompression
@@ -274,41 +562,152 @@ int main(int argc, char* argv[]) {
 
   }
 
-  if (num_streams == 1) {
-    memcpy(final_output_data, output_data[0], orig_sizes[0]);
-  } else if (num_streams == 2) {
-    // there can't be any size error here, so this function will always work
-    join_float_array(output_data[0], orig_sizes[0], output_data[1],
-        orig_sizes[1], final_output_data, final_output_size);
-  } else if (num_streams == 3) {
-    join_float_array_three_stream(output_data[0], orig_sizes[0],
-        output_data[1], orig_sizes[1], output_data[2], orig_sizes[2],
-        final_output_data, final_output_size);
-  } else {
-    error_and_exit("ERROR: impossible number of streams at reconstruction\n");
+  // Decide how the streams combine. Formats that have to be rebuilt front to
+  // back are joined here; the others are joined segment by segment as they are
+  // written, so reconstruction and writeback overlap across threads
+  int layout             = LAYOUT_DONE;
+  uint64_t element_size  = 4;
+  uint8_t* final_output_data = NULL;
+  if (planar) {
+    layout       = LAYOUT_PLANES;
+    element_size = num_streams;
+  } else if (num_streams == 1) {
+    layout       = LAYOUT_COPY;
+    element_size = 1;
+  } else if (num_streams == 2 && transform == TRANSFORM_NONE && orig_sizes[0] == 3 * orig_sizes[1]) {
+    // segments index the sign|fraction stream at 3 bytes per exponent byte,
+    // so mismatched streams take the zero-filled path below instead
+    layout = LAYOUT_FLOAT2;
   }
 
-  // Cleanup
-  for (uint64_t stream = 0; stream < num_streams; stream++) {
-    free(output_data[stream]);
+  if (layout != LAYOUT_COPY) {
+    final_output_data = malloc_and_check(final_output_size);
+  }
+
+  if (layout == LAYOUT_DONE) {
+    memset(final_output_data, 0, final_output_size);
+    if (num_streams == 2) {
+      // mismatched stream lengths are rejected by the join, leaving the output zeroed
+      join_float_array_with_transform(output_data[0], orig_sizes[0], output_data[1],
+          orig_sizes[1], final_output_data, final_output_size, transform);
+    } else if (num_streams == 3) {
+      join_float_array_three_stream(output_data[0], orig_sizes[0],
+          output_data[1], orig_sizes[1], output_data[2], orig_sizes[2],
+          final_output_data, final_output_size);
+    } else {
+      error_and_exit("ERROR: impossible number of streams at reconstruction\n");
+    }
   }
 
   // Create output file
   // This is done late in the process in case the input was invalid
-  FILE* output_fd = fopen(output_filename, "w");
-  if (output_fd == NULL) {
+  int output_fd = open(output_filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (output_fd < 0) {
     error_and_exit("ERROR: could not open output file\n");
   }
 
-  // Write data to output file
-  size_t write_len = fwrite(final_output_data, sizeof(uint8_t), final_output_size, output_fd);
-  if (write_len != final_output_size) {
+  // Reserve the whole file up front so a full disk fails now rather than
+  // part way through writing
+  if (final_output_size > 0 && fallocate(output_fd, 0, 0, final_output_size) != 0 &&
+      errno != EOPNOTSUPP && errno != ENOSYS) {
+    error_and_exit("ERROR: could not allocate space for output file\n");
+  }
+
+  // Split the output into one segment per writer
+  uint64_t num_elements = final_output_size / element_size;
+  uint64_t num_writers  = 1;
+  if (final_output_size >= PARALLEL_WRITE_MIN) {
+    long cpus   = sysconf(_SC_NPROCESSORS_ONLN);
+    num_writers = (cpus < 1) ? 1 : (cpus > MAX_WRITERS ? MAX_WRITERS : cpus);
+  }
+  uint64_t per_writer = ROUNDUP_ALIGN((num_elements + num_writers - 1) / num_writers, SEGMENT_ELEMENTS);
+  if (per_writer == 0) {
+    per_writer = SEGMENT_ELEMENTS;
+  }
+
+  output_segment_t segments[MAX_WRITERS];
+  pthread_t writers[MAX_WRITERS];
+  uint64_t num_segments = 0;
+  for (uint64_t first = 0; first < num_elements || num_segments == 0; first += per_writer) {
+    output_segment_t* seg = &segments[num_segments++];
+    seg->output_fd         = output_fd;
+    seg->layout            = layout;
+    seg->output_data       = output_data;
+    seg->num_streams       = num_streams;
+    seg->final_output_data = final_output_data;
+    seg->element_size      = element_size;
+    seg->first_element     = first;
+    seg->num_elements      = (num_elements - first < per_writer) ? num_elements - first : per_writer;
+    seg->failed            = false;
+  }
+
+  // The calling thread takes the first segment itself
+  for (uint64_t i = 1; i < num_segments; i++) {
+    if (pthread_create(&writers[i], NULL, write_output_segment, &segments[i]) != 0) {
+      error_and_exit("ERROR: could not start output writer\n");
+    }
+  }
+  write_output_segment(&segments[0]);
+  bool failed = segments[0].failed;
+  for (uint64_t i = 1; i < num_segments; i++) {
+    pthread_join(writers[i], NULL);
+    failed = failed || segments[i].failed;
+  }
+
+  if (failed) {
     error_and_exit("ERROR: could not write output file data\n");
   }
-  fclose(output_fd);
+  close(output_fd);
+
+  // Cleanup
+  for (uint64_t stream = 0; stream < num_streams; stream++) {
+    free(output_data[stream]);
+  }
   free(final_output_data);
   free(raw_data);
+}
+
+static void usage_and_exit(const char* program) {
+  printf("usage: %s [--key 0xNNNN | --key-file file | --key-fd fd] "
+         "inputfilename outputfilename [inputfilename outputfilename ...]\n", program);
+  error_and_exit("\n");
+}
+
+int main(int argc, char* argv[]) {
+  // Parse app flags
+  // Optional key source flags, then pairs of input and output filenames
+  int arg = 1;
+  while (arg < argc && strncmp(argv[arg], "--", 2) == 0) {
+    if (arg + 1 >= argc) {
+      usage_and_exit(argv[0]);
+    }
+    if (strcmp(argv[arg], "--key") == 0) {
+      key_option = argv[arg + 1];
+    } else if (strcmp(argv[arg], "--key-file") == 0) {
+      key_file_option = argv[arg + 1];
+    } else if (strcmp(argv[arg], "--key-fd") == 0) {
+      char* end = NULL;
+      errno = 0;
+      long fd = strtol(argv[arg + 1], &end, 10);
+      if (end == argv[arg + 1] || *end != '\0' || errno != 0 || fd < 0 || fd > INT_MAX) {
+        error_and_exit("ERROR: --key-fd must be a file descriptor number such as 3\n");
+      }
+      key_fd_option = fd;
+    } else {
+      usage_and_exit(argv[0]);
+    }
+    arg += 2;
+  }
+
+  if (arg >= argc || (argc - arg) % 2 != 0) {
+    usage_and_exit(argv[0]);
+  }
+
+  for (; arg < argc; arg += 2) {
+    unpack_file(argv[arg], argv[arg + 1]);
+  }
 
+  free(keystream);
   return 0;
 }
 
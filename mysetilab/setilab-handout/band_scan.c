@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <assert.h>
+#include <string.h>
 
 #include "filter.h"
 #include "signal.h"
@@ -12,24 +13,41 @@
 #define ALIENS_LOW  50000.0
 #define ALIENS_HIGH 150000.0
 
+// How band powers are estimated
+#define METHOD_FIR         0 // one band pass filter per band (default)
+#define METHOD_CHANNELIZER 1 // polyphase filterbank, all bands in one pass
+#define METHOD_WELCH       2 // averaged periodograms summed over each band
+#define METHOD_DDC         3 // each band mixed down and decimated first
+
+// Samples per block read in stream mode
+#define STREAM_BLOCK (1 << 20)
+
 void usage() {
-  printf("usage: band_scan text|bin|mmap signal_file Fs filter_order num_bands\n");
+  printf("usage: band_scan text|bin|mmap|stream signal_file Fs filter_order num_bands [fir|channelizer|welch|ddc] [zoom] [confirm] [cache=file]\n");
+  printf("       ddc decimates each band as far as its width allows, then filters it\n");
+  printf("       welch sizes its segments from filter_order and num_bands\n");
+  printf("       stream reads a binary signal a block at a time (fir only)\n");
+  printf("       Fs <= 0 takes the sample rate from a v2 binary file's header\n");
+  printf("       f32 and i16 v2 files are scanned as they are, without widening\n");
+  printf("       cache=file keeps the designed filters in file for the next run\n");
+  printf("       zoom refines the WOW bands with narrower, longer filters (not with stream)\n");
+  printf("       confirm tracks the strongest frequency in the WOW bands over time\n");
 }
 
-double avg_power(double* data, int num) {
+double avg_power(double* data, long num) {
 
   double ss = 0;
-  for (int i = 0; i < num; i++) {
+  for (long i = 0; i < num; i++) {
     ss += data[i] * data[i];
   }
 
   return ss / num;
 }
 
-double max_of(double* data, int num) {
+double max_of(double* data, long num) {
 
   double m = data[0];
-  for (int i = 1; i < num; i++) {
+  for (long i = 1; i < num; i++) {
     if (data[i] > m) {
       m = data[i];
     }
@@ -37,35 +55,324 @@ double max_of(double* data, int num) {
   return m;
 }
 
-double avg_of(double* data, int num) {
+double avg_of(double* data, long num) {
 
   double s = 0;
-  for (int i = 0; i < num; i++) {
+  for (long i = 0; i < num; i++) {
     s += data[i];
   }
   return s / num;
 }
 
-void remove_dc(double* data, int num) {
+void remove_dc(double* data, long num) {
 
   double dc = avg_of(data,num);
 
   printf("Removing DC component of %lf\n",dc);
 
-  for (int i = 0; i < num; i++) {
+  for (long i = 0; i < num; i++) {
     data[i] -= dc;
   }
 }
 
 
-int analyze_signal(signal* sig, int filter_order, int num_bands, double* lb, double* ub) {
+// Edges of num_bands equal bands from 0 to Fs/2
+void band_edges(double Fs, int num_bands, double low[], double high[]) {
+  double bandwidth = (Fs / 2) / num_bands;
+  for (int band = 0; band < num_bands; band++) {
+    low[band]  = band * bandwidth + 0.0001; // keep within limits
+    high[band] = (band + 1) * bandwidth - 0.0001;
+  }
+}
+
+// Makes the band pass filter for each band, from the cache when it can
+int make_band_filters(double Fs, int filter_order, int num_bands,
+                      double filter_coeffs[][filter_order + 1]) {
+  double low[num_bands];
+  double high[num_bands];
+  band_edges(Fs, num_bands, low, high);
+  return cached_band_pass_bank(Fs, filter_order, num_bands, low, high,
+                               FILTER_WINDOW_HAMMING, filter_coeffs);
+}
+
+int report_bands(double band_power[], int num_bands, double bandwidth,
+                 resources* rdiff, unsigned long long cycles, double seconds,
+                 double* lb, double* ub);
+
+// Convolves with the kernels for the signal's sample type
+void bank_power(signal* sig, int filter_order, int num_filters,
+                double filter_coeffs[][filter_order + 1], double power[]) {
+  if (sig->sample_type == SIGNAL_SAMPLE_F32) {
+    convolve_bank_and_compute_power_f32(sig->num_samples,
+                                        sig->data_f32,
+                                        filter_order,
+                                        num_filters,
+                                        filter_coeffs,
+                                        power);
+  } else if (sig->sample_type == SIGNAL_SAMPLE_I16) {
+    convolve_bank_and_compute_power_i16(sig->num_samples,
+                                        sig->data_i16,
+                                        sig->scale,
+                                        sig->offset,
+                                        filter_order,
+                                        num_filters,
+                                        filter_coeffs,
+                                        power);
+  } else {
+    convolve_bank_and_compute_power(sig->num_samples,
+                                    sig->data,
+                                    filter_order,
+                                    num_filters,
+                                    filter_coeffs,
+                                    power);
+  }
+}
+
+// Zoom: the coarse scan's WOW bands are split ZOOM_SPLIT ways, with a
+// filter ZOOM_SPLIT times longer to keep the same relative sharpness, and
+// only the pieces that still cross THRESHOLD are split again. A piece's
+// threshold is the coarse average scaled to its width, as noise power
+// goes with bandwidth. Only the range of interest is ever refined.
+#define ZOOM_SPLIT     4
+#define ZOOM_LEVELS    3
+#define ZOOM_MAX_ORDER 8192
+#define ZOOM_MAX_BANDS 256  // per level; more means the signal is not a carrier
+
+int zoom_bands(signal* sig, int filter_order, int num_bands, double band_power[],
+               double* lb, double* ub) {
+
+  double bandwidth = (sig->Fs / 2) / num_bands;
+  double density   = avg_of(band_power, num_bands) / bandwidth;
+
+  // Start from the coarse WOW bands
+  int num_hot = 0;
+  double hot_low[ZOOM_MAX_BANDS];
+  double hot_high[ZOOM_MAX_BANDS];
+  for (int band = 0; band < num_bands; band++) {
+    double band_low  = band * bandwidth;
+    double band_high = (band + 1) * bandwidth;
+    if (band_high >= ALIENS_LOW && band_low <= ALIENS_HIGH &&
+        band_power[band] > THRESHOLD * density * bandwidth) {
+      if (num_hot == ZOOM_MAX_BANDS) {
+        printf("Too many bands to zoom into\n");
+        return 1;
+      }
+      hot_low[num_hot]  = band_low;
+      hot_high[num_hot] = band_high;
+      num_hot++;
+    }
+  }
+
+  double start = get_seconds();
+
+  int order = filter_order;
+  double width = bandwidth;
+  for (int level = 1; level <= ZOOM_LEVELS && num_hot > 0; level++) {
+    if (num_hot * ZOOM_SPLIT > ZOOM_MAX_BANDS) {
+      break;
+    }
+    width /= ZOOM_SPLIT;
+    if (order * ZOOM_SPLIT <= ZOOM_MAX_ORDER) {
+      order *= ZOOM_SPLIT;
+    }
+
+    // The pieces of every hot band that touch the range of interest
+    int n = 0;
+    double low[ZOOM_MAX_BANDS];
+    double high[ZOOM_MAX_BANDS];
+    for (int h = 0; h < num_hot; h++) {
+      for (int k = 0; k < ZOOM_SPLIT; k++) {
+        double piece_low  = hot_low[h] + k * width;
+        double piece_high = piece_low + width;
+        if (piece_high >= ALIENS_LOW && piece_low <= ALIENS_HIGH) {
+          low[n]  = piece_low + 0.0001; // keep within limits
+          high[n] = piece_high - 0.0001;
+          n++;
+        }
+      }
+    }
+
+    double (*filter_coeffs)[order + 1] = malloc(sizeof(double) * (order + 1) * n);
+    if (!filter_coeffs) {
+      printf("Unable to allocate filter bank\n");
+      return -1;
+    }
+    if (cached_band_pass_bank(sig->Fs, order, n, low, high,
+                              FILTER_WINDOW_HAMMING, filter_coeffs)) {
+      printf("Unable to make filters\n");
+      free(filter_coeffs);
+      return -1;
+    }
+    double power[n];
+    bank_power(sig, order, n, filter_coeffs, power);
+    free(filter_coeffs);
+
+    printf("zoom %d: %d bands of %lf Hz, order %d\n", level, n, width, order);
+
+    // Keep the pieces that still stand out; if none does the power is
+    // spread over the previous level's bands and they are the answer
+    int num_next = 0;
+    for (int i = 0; i < n; i++) {
+      int wow = power[i] > THRESHOLD * density * width;
+      printf("      %20lf to %20lf Hz: %20lf %s\n",
+             low[i], high[i], power[i], wow ? "(WOW)" : "(meh)");
+      if (wow) {
+        hot_low[num_next]  = low[i] - 0.0001;
+        hot_high[num_next] = high[i] + 0.0001;
+        num_next++;
+      }
+    }
+    if (!num_next) {
+      break;
+    }
+    num_hot = num_next;
+  }
+
+  *lb = hot_low[0] + 0.0001;
+  *ub = hot_high[num_hot - 1] - 0.0001;
+
+  printf("Zoom took %lf seconds by basic timing\n", get_seconds() - start);
+
+  return 1;
+}
+
+// Confirm: a sliding DFT over windows of CONFIRM_WINDOW samples follows
+// the strongest frequency in the flagged range from window to window, and
+// a Goertzel bank over the whole signal then pins it down to the signal's
+// full resolution. A carrier is confirmed if the strongest frequency
+// stands out from the range in most windows.
+#define CONFIRM_WINDOW    8192
+#define CONFIRM_MAX_FREQS 4096
+
+int confirm_carrier(signal* sig, double lb, double ub) {
+
+  double start = get_seconds();
+
+  // the window's resolution across the range, or coarser for wide ranges
+  double step = sig->Fs / CONFIRM_WINDOW;
+  int num_freqs = (int)((ub - lb) / step) + 1;
+  if (num_freqs > CONFIRM_MAX_FREQS) {
+    num_freqs = CONFIRM_MAX_FREQS;
+    step = (ub - lb) / (num_freqs - 1);
+  }
+  long windows = sliding_dft_windows(sig->num_samples, CONFIRM_WINDOW, CONFIRM_WINDOW);
+  if (windows < 1) {
+    printf("Signal too short to confirm a carrier\n");
+    return 0;
+  }
+
+  double* freqs = malloc(sizeof(double) * num_freqs);
+  double* power = malloc(sizeof(double) * num_freqs * windows);
+  double* total = calloc(num_freqs, sizeof(double));
+  if (!freqs || !power || !total) {
+    printf("Unable to allocate detector bank\n");
+    free(freqs);
+    free(power);
+    free(total);
+    return -1;
+  }
+  for (int f = 0; f < num_freqs; f++) {
+    freqs[f] = lb + f * step;
+  }
+
+  if (sliding_dft_power(sig->num_samples, sig->data, sig->Fs, num_freqs, freqs,
+                        CONFIRM_WINDOW, CONFIRM_WINDOW, power)) {
+    printf("Unable to track carrier\n");
+    free(freqs);
+    free(power);
+    free(total);
+    return -1;
+  }
+
+  printf("carrier track, %d frequencies %lf Hz apart:\n", num_freqs, step);
+  long standout = 0;
+  for (long t = 0; t < windows; t++) {
+    double* p = &power[t * num_freqs];
+    int peak = 0;
+    for (int f = 0; f < num_freqs; f++) {
+      total[f] += p[f];
+      if (p[f] > p[peak]) {
+        peak = f;
+      }
+    }
+    double avg = avg_of(p, num_freqs);
+    int wow = p[peak] > THRESHOLD * avg;
+    standout += wow;
+    printf("  %12lf s %20lf Hz: %20lf %s\n",
+           (double)(t * CONFIRM_WINDOW) / sig->Fs, freqs[peak], p[peak], wow ? "(WOW)" : "(meh)");
+  }
+
+  int peak = 0;
+  for (int f = 0; f < num_freqs; f++) {
+    if (total[f] > total[peak]) {
+      peak = f;
+    }
+  }
+
+  // refine around the strongest frequency over the whole signal
+  double fine_step = sig->Fs / sig->num_samples;
+  double center = freqs[peak];
+  int num_fine = (int)(2 * step / fine_step) + 1;
+  if (num_fine > CONFIRM_MAX_FREQS) {
+    num_fine = CONFIRM_MAX_FREQS;
+    fine_step = 2 * step / (num_fine - 1);
+  }
+  double fine[num_fine];
+  double fine_power[num_fine];
+  for (int f = 0; f < num_fine; f++) {
+    fine[f] = center - step + f * fine_step;
+  }
+  int rc = goertzel_bank(sig->num_samples, sig->data, sig->Fs, num_fine, fine, fine_power);
+  int best = 0;
+  for (int f = 0; f < num_fine && rc == 0; f++) {
+    if (fine_power[f] > fine_power[best]) {
+      best = f;
+    }
+  }
+
+  free(freqs);
+  free(power);
+  free(total);
+  if (rc) {
+    printf("Unable to refine carrier\n");
+    return -1;
+  }
+
+  int confirmed = 2 * standout > windows;
+  printf("carrier %lf Hz, power %lf, strongest in %ld of %ld windows (%s)\n",
+         fine[best], fine_power[best], standout, windows,
+         confirmed ? "confirmed" : "not confirmed");
+  printf("Confirm took %lf seconds by basic timing\n", get_seconds() - start);
+
+  return confirmed;
+}
+
+int analyze_signal(signal* sig, int filter_order, int num_bands, int method, int zoom,
+                   int confirm, double* lb, double* ub) {
 
   double Fc        = (sig->Fs) / 2;
   double bandwidth = Fc / num_bands;
 
-  remove_dc(sig->data,sig->num_samples);
+  // only fir takes narrow samples
+  if (method != METHOD_FIR && widen_signal(sig)) {
+    printf("Unable to widen signal\n");
+    return -1;
+  }
 
-  double signal_power = avg_power(sig->data,sig->num_samples);
+  double dc;
+  double signal_power;
+  if (sig->sample_type == SIGNAL_SAMPLE_F64 && signal_summary_stats(sig, &dc, &signal_power)) {
+    remove_dc(sig->data,sig->num_samples);
+    signal_power = avg_power(sig->data,sig->num_samples);
+  } else {
+    // the file's summaries already have both, which saves two passes;
+    // narrow samples get both in one pass
+    if (signal_summary_stats(sig, &dc, &signal_power)) {
+      signal_stats(sig, &dc, &signal_power);
+    }
+    printf("Removing DC component of %lf\n",dc);
+    remove_signal_dc(sig, dc);
+  }
 
   printf("signal average power:     %lf\n", signal_power);
 
@@ -74,26 +381,148 @@ int analyze_signal(signal* sig, int filter_order, int num_bands, double* lb, dou
   double start = get_seconds();
   unsigned long long tstart = get_cycle_count();
 
-  double filter_coeffs[filter_order + 1];
   double band_power[num_bands];
-  for (int band = 0; band < num_bands; band++) {
-    // Make the filter
-    generate_band_pass(sig->Fs,
-                       band * bandwidth + 0.0001, // keep within limits
-                       (band + 1) * bandwidth - 0.0001,
-                       filter_order,
-                       filter_coeffs);
-    hamming_window(filter_order,filter_coeffs);
+  if (method == METHOD_CHANNELIZER) {
+    // All bands at once
+    channelize_and_compute_power(sig->num_samples,
+                                 sig->data,
+                                 sig->Fs,
+                                 filter_order,
+                                 num_bands,
+                                 band_power);
+  } else if (method == METHOD_WELCH) {
+    // One PSD, then each band is a sum over its bins
+    int seg_len = welch_segment_length(filter_order, num_bands);
+    double* psd = malloc(sizeof(double) * (seg_len / 2 + 1));
+    if (!psd || welch_psd(sig->num_samples, sig->data, seg_len, psd)) {
+      printf("Unable to estimate spectrum\n");
+      free(psd);
+      return -1;
+    }
+    printf("Welch segments of %d samples\n", seg_len);
+
+    double low[num_bands];
+    double high[num_bands];
+    band_edges(sig->Fs, num_bands, low, high);
+    welch_band_power(seg_len, psd, sig->Fs, num_bands, low, high, band_power);
+    free(psd);
+  } else if (method == METHOD_DDC) {
+    // Each band at the lowest rate its width allows
+    double low[num_bands];
+    double high[num_bands];
+    band_edges(sig->Fs, num_bands, low, high);
+    for (int band = 0; band < num_bands; band++) {
+      int decimation = ddc_decimation(sig->Fs, low[band], high[band]);
+      if (band == 0) {
+        printf("DDC decimation %d, order %d\n", decimation, ddc_order(filter_order, decimation));
+      }
+      if (ddc_band_power(sig->num_samples, sig->data, sig->Fs, low[band], high[band],
+                         ddc_order(filter_order, decimation), decimation, &band_power[band])) {
+        printf("Unable to down-convert band %d\n", band);
+        return -1;
+      }
+    }
+  } else {
+    // Make all the filters, then run them together as one bank
+    double (*filter_coeffs)[filter_order + 1] =
+      malloc(sizeof(double) * (filter_order + 1) * num_bands);
+    if (!filter_coeffs) {
+      printf("Unable to allocate filter bank\n");
+      return -1;
+    }
+
+    if (make_band_filters(sig->Fs, filter_order, num_bands, filter_coeffs)) {
+      printf("Unable to make filters\n");
+      free(filter_coeffs);
+      return -1;
+    }
+
+    bank_power(sig, filter_order, num_bands, filter_coeffs, band_power);
+
+    free(filter_coeffs);
+  }
+
+  unsigned long long tend = get_cycle_count();
+  double end = get_seconds();
+
+  resources rend;
+  get_resources(&rend,THIS_PROCESS);
+
+  resources rdiff;
+  get_resources_diff(&rstart, &rend, &rdiff);
+
+  int wow = report_bands(band_power, num_bands, bandwidth, &rdiff, tend - tstart, end - start, lb, ub);
+  if (wow > 0 && zoom) {
+    wow = zoom_bands(sig, filter_order, num_bands, band_power, lb, ub);
+  }
+  if (wow > 0 && confirm) {
+    // the detectors only take doubles
+    if (widen_signal(sig)) {
+      printf("Unable to widen signal\n");
+      return -1;
+    }
+    if (confirm_carrier(sig, *lb, *ub) < 0) {
+      return -1;
+    }
+  }
+  return wow;
+}
+
+// Stream mode: the signal is never all in memory. DC is removed by
+// correcting the band powers at the end instead of in a pass up front
+int analyze_stream(char* file, double Fs, int filter_order, int num_bands, double* lb, double* ub) {
+
+  double bandwidth = (Fs / 2) / num_bands;
+
+  resources rstart;
+  get_resources(&rstart,THIS_PROCESS);
+  double start = get_seconds();
+  unsigned long long tstart = get_cycle_count();
+
+  double (*filter_coeffs)[filter_order + 1] =
+    malloc(sizeof(double) * (filter_order + 1) * num_bands);
+  if (!filter_coeffs) {
+    printf("Unable to allocate filter bank\n");
+    return -1;
+  }
+  if (make_band_filters(Fs, filter_order, num_bands, filter_coeffs)) {
+    printf("Unable to make filters\n");
+    free(filter_coeffs);
+    return -1;
+  }
+
+  fir_stream* fs = fir_stream_create(filter_order, num_bands, filter_coeffs);
+  signal_stream* in = open_signal_stream(file, STREAM_BLOCK);
+  free(filter_coeffs);
+  if (!fs || !in) {
+    printf("Unable to start stream\n");
+    fir_stream_destroy(fs);
+    close_signal_stream(in);
+    return -1;
+  }
 
-    // Convolve
-    convolve_and_compute_power(sig->num_samples,
-                               sig->data,
-                               filter_order,
-                               filter_coeffs,
-                               &(band_power[band]));
+  double* block;
+  long count;
+  while ((count = read_signal_stream(in, &block)) > 0) {
+    if (fir_stream_push(fs, count, block)) {
+      count = -1;
+      break;
+    }
+  }
+  close_signal_stream(in);
 
+  double band_power[num_bands];
+  if (count < 0 || fir_stream_power(fs, 1, band_power)) {
+    printf("Stream failed\n");
+    fir_stream_destroy(fs);
+    return -1;
   }
 
+  printf("Streamed %ld samples\n", fir_stream_samples(fs));
+  printf("Removing DC component of %lf\n", fir_stream_mean(fs));
+  printf("signal average power:     %lf\n", fir_stream_signal_power(fs, 1));
+  fir_stream_destroy(fs);
+
   unsigned long long tend = get_cycle_count();
   double end = get_seconds();
 
@@ -103,6 +532,13 @@ int analyze_signal(signal* sig, int filter_order, int num_bands, double* lb, dou
   resources rdiff;
   get_resources_diff(&rstart, &rend, &rdiff);
 
+  return report_bands(band_power, num_bands, bandwidth, &rdiff, tend - tstart, end - start, lb, ub);
+}
+
+int report_bands(double band_power[], int num_bands, double bandwidth,
+                 resources* rdiff, unsigned long long cycles, double seconds,
+                 double* lb, double* ub) {
+
   // Pretty print results
   double max_band_power = max_of(band_power,num_bands);
   double avg_band_power = avg_of(band_power,num_bands);
@@ -150,25 +586,25 @@ Page swaps       %ld\n\
 Blocks of I/O    %ld\n\
 Signals caught   %ld\n\
 Context switches %ld\n",
-         rdiff.usertime,
-         rdiff.systime,
-         rdiff.pagefaults,
-         rdiff.pageswaps,
-         rdiff.ioblocks,
-         rdiff.sigs,
-         rdiff.contextswitches);
+         rdiff->usertime,
+         rdiff->systime,
+         rdiff->pagefaults,
+         rdiff->pageswaps,
+         rdiff->ioblocks,
+         rdiff->sigs,
+         rdiff->contextswitches);
 
   printf("Analysis took %llu cycles (%lf seconds) by cycle count, timing overhead=%llu cycles\n"
          "Note that cycle count only makes sense if the thread stayed on one core\n",
-         tend - tstart, cycles_to_seconds(tend - tstart), timing_overhead());
-  printf("Analysis took %lf seconds by basic timing\n", end - start);
+         cycles, cycles_to_seconds(cycles), timing_overhead());
+  printf("Analysis took %lf seconds by basic timing\n", seconds);
 
   return wow;
 }
 
 int main(int argc, char* argv[]) {
 
-  if (argc != 6) {
+  if (argc < 6) {
     usage();
     return -1;
   }
@@ -178,8 +614,51 @@ int main(int argc, char* argv[]) {
   double Fs        = atof(argv[3]);
   int filter_order = atoi(argv[4]);
   int num_bands    = atoi(argv[5]);
+  int method       = METHOD_FIR;
+  int zoom         = 0;
+  int confirm      = 0;
+  char* cache_file = 0;
+
+  for (int i = 6; i < argc; i++) {
+    if (!strcmp(argv[i], "channelizer")) {
+      method = METHOD_CHANNELIZER;
+    } else if (!strcmp(argv[i], "welch")) {
+      method = METHOD_WELCH;
+    } else if (!strcmp(argv[i], "ddc")) {
+      method = METHOD_DDC;
+    } else if (!strcmp(argv[i], "fir")) {
+      method = METHOD_FIR;
+    } else if (!strcmp(argv[i], "zoom")) {
+      zoom = 1;
+    } else if (!strcmp(argv[i], "confirm")) {
+      confirm = 1;
+    } else if (!strncmp(argv[i], "cache=", 6)) {
+      cache_file = argv[i] + 6;
+    } else {
+      usage();
+      return -1;
+    }
+  }
+
+  // a missing cache file is just an empty cache
+  if (cache_file) {
+    filter_cache_load(cache_file);
+  }
+
+  // a v2 binary file knows its own sample rate
+  if (Fs <= 0.0 && sig_type != 'T') {
+    signal_info info;
+    if (read_signal_info(sig_file, &info)) {
+      printf("Unable to read file header\n");
+      return -1;
+    }
+    Fs = info.Fs;
+  }
+  if (Fs <= 0.0) {
+    printf("No sample rate given and none in the file\n");
+    return -1;
+  }
 
-  assert(Fs > 0.0);
   assert(filter_order > 0 && !(filter_order & 0x1));
   assert(num_bands > 0);
 
@@ -187,12 +666,37 @@ int main(int argc, char* argv[]) {
 file:     %s\n\
 Fs:       %lf Hz\n\
 order:    %d\n\
-bands:    %d\n",
-         sig_type == 'T' ? "Text" : (sig_type == 'B' ? "Binary" : (sig_type == 'M' ? "Mapped Binary" : "UNKNOWN TYPE")),
+bands:    %d\n\
+method:   %s\n",
+         sig_type == 'T' ? "Text" : (sig_type == 'B' ? "Binary" : (sig_type == 'M' ? "Mapped Binary" : (sig_type == 'S' ? "Streamed Binary" : "UNKNOWN TYPE"))),
          sig_file,
          Fs,
          filter_order,
-         num_bands);
+         num_bands,
+         method == METHOD_CHANNELIZER ? "Channelizer" : (method == METHOD_WELCH ? "Welch" : (method == METHOD_DDC ? "DDC" : "FIR")));
+
+  double start = 0;
+  double end   = 0;
+
+  if (sig_type == 'S') {
+    if (method != METHOD_FIR) {
+      printf("Stream mode only supports fir\n");
+      return -1;
+    }
+    int wow = analyze_stream(sig_file, Fs, filter_order, num_bands, &start, &end);
+    if (wow < 0) {
+      return -1;
+    }
+    if (wow) {
+      printf("POSSIBLE ALIENS %lf-%lf HZ (CENTER %lf HZ)\n", start, end, (end + start) / 2.0);
+    } else {
+      printf("no aliens\n");
+    }
+    if (cache_file) {
+      filter_cache_save(cache_file);
+    }
+    return 0;
+  }
 
   printf("Load or map file\n");
 
@@ -222,9 +726,13 @@ bands:    %d\n",
 
   sig->Fs = Fs;
 
-  double start = 0;
-  double end   = 0;
-  if (analyze_signal(sig, filter_order, num_bands, &start, &end)) {
+  int wow = analyze_signal(sig, filter_order, num_bands, method, zoom, confirm, &start, &end);
+  if (wow < 0) {
+    printf("Unable to analyze signal\n");
+    free_signal(sig);
+    return -1;
+  }
+  if (wow) {
     printf("POSSIBLE ALIENS %lf-%lf HZ (CENTER %lf HZ)\n", start, end, (end + start) / 2.0);
   } else {
     printf("no aliens\n");
@@ -232,6 +740,10 @@ bands:    %d\n",
 
   free_signal(sig);
 
+  if (cache_file) {
+    filter_cache_save(cache_file);
+  }
+
   return 0;
 }
 
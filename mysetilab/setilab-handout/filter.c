@@ -2,6 +2,12 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include "filter.h"
 
@@ -83,61 +89,2533 @@ int hamming_window(int order, double coeffs[]) {
   assert(order > 0 && !(order & 0x1));
 
   for (int n = 0; n <= order; n++) {
-    coeffs[n] = coeffs[n] * (0.54 - 0.46 * cos(2 * M_PI * n / order));
+    // the window is symmetric, so compute it from the nearer end to keep
+    // coeffs[n] and coeffs[order - n] bit-for-bit equal
+    int m = n <= order / 2 ? n : order - n;
+    coeffs[n] = coeffs[n] * (0.54 - 0.46 * cos(2 * M_PI * m / order));
   }
 
   return 0;
 
 }
 
+
+/* Filter bank design */
+
+// sin(2 pi t) for t >= 0 with no calls, so loops over it vectorize.
+// t is reduced to r in [-1/2, 1/2) turns, r to a quarter turn q and a
+// remainder u in [-1/8, 1/8], and sin or cos of 2 pi u comes from its
+// Taylor series, whose truncation error there is below 1e-16
+static inline double sin_turns(double t) {
+  int n = (int)(t + 0.5);
+  double r = t - n;
+  int q = (int)(4 * r + 2.5) - 2;
+  double a  = 2 * M_PI * (r - 0.25 * q);
+  double a2 = a * a;
+  double s = a * (1 + a2 * (-1.0 / 6 + a2 * (1.0 / 120 + a2 * (-1.0 / 5040 +
+             a2 * (1.0 / 362880 + a2 * (-1.0 / 39916800 + a2 * (1.0 / 6227020800.0 +
+             a2 * (-1.0 / 1307674368000.0))))))));
+  double c = 1 + a2 * (-0.5 + a2 * (1.0 / 24 + a2 * (-1.0 / 720 + a2 * (1.0 / 40320 +
+             a2 * (-1.0 / 3628800 + a2 * (1.0 / 479001600 + a2 * (-1.0 / 87178291200.0 +
+             a2 * (1.0 / 20922789888000.0))))))));
+  // quadrant by exact multiplies by 0, 1 and -1, since branches (even
+  // as ?:) keep the loops from vectorizing
+  double odd  = q & 1;
+  double sign = 1 - (q & 2);
+  return sign * ((1 - odd) * s + odd * c);
+}
+
+int generate_band_pass_bank(double Fs, int order, int num_filters,
+                            double Fcl[], double Fch[], int window,
+                            double coeffs[][order + 1]) {
+  assert(order > 0 && !(order & 0x1));
+
+  int h = order / 2;
+
+  // taps are even around the middle, so only k = |n - h| >= 0 is designed
+  double win[h + 1];
+  double inv[h + 1];
+  for (int k = 0; k <= h; k++) {
+    // same expression as hamming_window(), with m = h - k
+    win[k] = window == FILTER_WINDOW_HAMMING ? 0.54 - 0.46 * cos(2 * M_PI * (h - k) / order) : 1;
+    inv[k] = k ? win[k] / (M_PI * k) : 0;
+  }
+
+  for (int f = 0; f < num_filters; f++) {
+    assert(Fs > 0 && Fcl[f] > 0 && Fcl[f] < Fs / 2 && Fch[f] > 0 && Fch[f] < Fs / 2);
+    double Ftl = Fcl[f] / Fs;
+    double Fth = Fch[f] / Fs;
+    double* c  = coeffs[f];
+
+    // upper half in one unit stride loop, then mirrored
+    c[h] = 2 * (Fth - Ftl) * win[0];
+    double* upper = &c[h];
+    for (int k = 1; k <= h; k++) {
+      upper[k] = (sin_turns(Fth * k) - sin_turns(Ftl * k)) * inv[k];
+    }
+    for (int k = 1; k <= h; k++) {
+      c[h - k] = upper[k];
+    }
+  }
+  return 0;
+}
+
+
+/* Filter coefficient cache */
+
+// Chained hash table of designed filters, one entry per filter. Lookups
+// match keys exactly, which is what repeated scans with the same
+// parameters give. Past FILTER_CACHE_LIMIT taps the table starts over.
+
+#define FILTER_CACHE_BUCKETS 4096
+#define FILTER_CACHE_LIMIT   (1L << 24) // taps, 128 MB
+#define FILTER_CACHE_MAGIC   "SETIFLT"
+
+typedef struct filter_key_ {
+  double Fs;
+  double Fcl;
+  double Fch;
+  int32_t order;
+  int32_t window;
+} filter_key;
+
+typedef struct filter_entry_ {
+  filter_key key;
+  struct filter_entry_* next;
+  double coeffs[];   // order + 1
+} filter_entry;
+
+static filter_entry* filter_cache[FILTER_CACHE_BUCKETS];
+static long filter_cache_taps;
+static pthread_mutex_t filter_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned filter_hash(filter_key* key) {
+  unsigned long long h = 0xcbf29ce484222325ULL;
+  const unsigned char* p = (const unsigned char*)key;
+  for (size_t i = 0; i < sizeof(filter_key); i++) {
+    h = (h ^ p[i]) * 0x100000001b3ULL;
+  }
+  return (unsigned)(h % FILTER_CACHE_BUCKETS);
+}
+
+static void make_key(filter_key* key, double Fs, double Fcl, double Fch, int order, int window) {
+  memset(key, 0, sizeof(filter_key)); // no stray padding in the hash
+  key->Fs     = Fs;
+  key->Fcl    = Fcl;
+  key->Fch    = Fch;
+  key->order  = order;
+  key->window = window;
+}
+
+static filter_entry* cache_find(filter_key* key) {
+  for (filter_entry* e = filter_cache[filter_hash(key)]; e; e = e->next) {
+    if (!memcmp(&e->key, key, sizeof(filter_key))) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+static void cache_clear_locked(void) {
+  for (int b = 0; b < FILTER_CACHE_BUCKETS; b++) {
+    while (filter_cache[b]) {
+      filter_entry* e = filter_cache[b];
+      filter_cache[b] = e->next;
+      free(e);
+    }
+  }
+  filter_cache_taps = 0;
+}
+
+static int cache_add(filter_key* key, double coeffs[]) {
+  if (cache_find(key)) {
+    return 0;
+  }
+  if (filter_cache_taps + key->order + 1 > FILTER_CACHE_LIMIT) {
+    cache_clear_locked();
+  }
+  filter_entry* e = (filter_entry*)malloc(sizeof(filter_entry) + sizeof(double) * (key->order + 1));
+  if (!e) {
+    return -1;
+  }
+  e->key = *key;
+  memcpy(e->coeffs, coeffs, sizeof(double) * (key->order + 1));
+  unsigned b = filter_hash(key);
+  e->next = filter_cache[b];
+  filter_cache[b] = e;
+  filter_cache_taps += key->order + 1;
+  return 0;
+}
+
+int cached_band_pass_bank(double Fs, int order, int num_filters,
+                          double Fcl[], double Fch[], int window,
+                          double coeffs[][order + 1]) {
+
+  pthread_mutex_lock(&filter_cache_lock);
+
+  // copy the hits, collect the misses
+  int* miss = (int*)malloc(sizeof(int) * num_filters);
+  double* lo = (double*)malloc(sizeof(double) * num_filters);
+  double* hi = (double*)malloc(sizeof(double) * num_filters);
+  int rc = (miss && lo && hi) ? 0 : -1;
+  int num_miss = 0;
+  for (int f = 0; f < num_filters && rc == 0; f++) {
+    filter_key key;
+    make_key(&key, Fs, Fcl[f], Fch[f], order, window);
+    filter_entry* e = cache_find(&key);
+    if (e) {
+      memcpy(coeffs[f], e->coeffs, sizeof(double) * (order + 1));
+    } else {
+      lo[num_miss] = Fcl[f];
+      hi[num_miss] = Fch[f];
+      miss[num_miss++] = f;
+    }
+  }
+
+  // design the misses together, then spread them out and remember them
+  if (rc == 0 && num_miss > 0) {
+    double (*designed)[order + 1] = malloc(sizeof(double) * (order + 1) * num_miss);
+    if (!designed) {
+      rc = -1;
+    } else {
+      generate_band_pass_bank(Fs, order, num_miss, lo, hi, window, designed);
+      for (int m = 0; m < num_miss; m++) {
+        filter_key key;
+        make_key(&key, Fs, lo[m], hi[m], order, window);
+        memcpy(coeffs[miss[m]], designed[m], sizeof(double) * (order + 1));
+        cache_add(&key, designed[m]); // a full cache just means designing again
+      }
+      free(designed);
+    }
+  }
+
+  pthread_mutex_unlock(&filter_cache_lock);
+
+  free(miss);
+  free(lo);
+  free(hi);
+  return rc;
+}
+
+void filter_cache_clear(void) {
+  pthread_mutex_lock(&filter_cache_lock);
+  cache_clear_locked();
+  pthread_mutex_unlock(&filter_cache_lock);
+}
+
+// File: FILTER_CACHE_MAGIC, then per filter its filter_key and order + 1
+// doubles, native byte order
+int filter_cache_save(const char* file) {
+  FILE* f = fopen(file, "wb");
+  if (!f) {
+    perror("Cannot open filter cache");
+    return -1;
+  }
+
+  pthread_mutex_lock(&filter_cache_lock);
+  int ok = fwrite(FILTER_CACHE_MAGIC, sizeof(FILTER_CACHE_MAGIC), 1, f) == 1;
+  for (int b = 0; b < FILTER_CACHE_BUCKETS && ok; b++) {
+    for (filter_entry* e = filter_cache[b]; e && ok; e = e->next) {
+      ok = fwrite(&e->key, sizeof(filter_key), 1, f) == 1 &&
+           fwrite(e->coeffs, sizeof(double), e->key.order + 1, f) == (size_t)(e->key.order + 1);
+    }
+  }
+  pthread_mutex_unlock(&filter_cache_lock);
+
+  if (fclose(f) || !ok) {
+    perror("Cannot write filter cache");
+    return -1;
+  }
+  return 0;
+}
+
+int filter_cache_load(const char* file) {
+  FILE* f = fopen(file, "rb");
+  if (!f) {
+    return -1;
+  }
+
+  char magic[sizeof(FILTER_CACHE_MAGIC)];
+  if (fread(magic, sizeof(magic), 1, f) != 1 || memcmp(magic, FILTER_CACHE_MAGIC, sizeof(magic))) {
+    printf("%s: not a filter cache\n", file);
+    fclose(f);
+    return -1;
+  }
+
+  pthread_mutex_lock(&filter_cache_lock);
+  int rc = 0;
+  filter_key key;
+  while (fread(&key, sizeof(filter_key), 1, f) == 1) {
+    if (key.order <= 0 || (key.order & 0x1) || key.order > FILTER_CACHE_LIMIT) {
+      rc = -1;
+      break;
+    }
+    double* c = (double*)malloc(sizeof(double) * (key.order + 1));
+    if (!c || fread(c, sizeof(double), key.order + 1, f) != (size_t)(key.order + 1)) {
+      free(c);
+      rc = -1;
+      break;
+    }
+    filter_key clean;
+    make_key(&clean, key.Fs, key.Fcl, key.Fch, key.order, key.window);
+    cache_add(&clean, c);
+    free(c);
+  }
+  pthread_mutex_unlock(&filter_cache_lock);
+
+  if (rc) {
+    printf("%s: corrupt filter cache, kept what was read before the damage\n", file);
+  }
+  fclose(f);
+  return rc;
+}
+
+/* Direct FIR kernels */
+
+// Each kernel returns the sum of squared outputs y[i] for start <= i < end,
+// y[i] = sum_j coeffs[j] * input_signal[i - j]
+// The body kernels only see i >= order, where every tap has input behind it,
+// so their inner loops are branch free. The first order outputs (the warm up
+// with zero history) go through fir_power_prologue() instead.
+
+typedef double (*fir_power_body_fn)(double input_signal[], int order, double coeffs[],
+                                    long start, long end);
+
+static double fir_power_prologue(long length, double input_signal[], int order, double coeffs[],
+                                 long start, long end) {
+  double pow_sum = 0;
+  for (long i = start; i < end; i++) {
+    double cur_sum = 0;
+    for (int j = (i < order ? i : order); j >= 0; j--) {
+      cur_sum += input_signal[i - j] * coeffs[j];
+    }
+    pow_sum += cur_sum * cur_sum;
+  }
+  return pow_sum;
+}
+
+static double fir_power_body_scalar(double input_signal[], int order, double coeffs[],
+                                    long start, long end) {
+  double pow_sum = 0;
+  for (long i = start; i < end; i++) {
+    double cur_sum = 0;
+    for (int j = order; j >= 0; j--) {
+      cur_sum += input_signal[i - j] * coeffs[j];
+    }
+    pow_sum += cur_sum * cur_sum;
+  }
+  return pow_sum;
+}
+
+// Linear phase (symmetric) filters, coeffs[j] == coeffs[order - j], like every
+// generate_*() filter after hamming_window(). The mirrored inputs are added
+// first so each pair of taps costs one multiply:
+//   y[i] = half[h] x[i - h] + sum_{j < h} half[j] (x[i - j] + x[i - order + j])
+// with h = order / 2 and half[] the first h + 1 coefficients
+
+static int is_symmetric(int order, double coeffs[]) {
+  if (order & 0x1) {
+    return 0;
+  }
+  double scale = 0;
+  for (int j = 0; j <= order; j++) {
+    scale = fmax(scale, fabs(coeffs[j]));
+  }
+  for (int j = 0; j < order / 2; j++) {
+    if (fabs(coeffs[j] - coeffs[order - j]) > 1e-12 * scale) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static double fir_power_body_symmetric_scalar(double input_signal[], int order, double half[],
+                                              long start, long end) {
+  int h = order / 2;
+  double pow_sum = 0;
+  for (long i = start; i < end; i++) {
+    double cur_sum = half[h] * input_signal[i - h];
+    for (int j = 0; j < h; j++) {
+      cur_sum += half[j] * (input_signal[i - j] + input_signal[i - order + j]);
+    }
+    pow_sum += cur_sum * cur_sum;
+  }
+  return pow_sum;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// 16 outputs per pass: four vectors of four, each tap's coefficient
+// broadcast once and applied to all four
+__attribute__((target("avx2,fma")))
+static double fir_power_body_avx2(double input_signal[], int order, double coeffs[],
+                                  long start, long end) {
+  __m256d sq = _mm256_setzero_pd();
+  long i = start;
+
+  for (; i + 16 <= end; i += 16) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    __m256d acc2 = _mm256_setzero_pd();
+    __m256d acc3 = _mm256_setzero_pd();
+    for (int j = order; j >= 0; j--) {
+      __m256d c = _mm256_broadcast_sd(&coeffs[j]);
+      double* x = &input_signal[i - j];
+      acc0 = _mm256_fmadd_pd(c, _mm256_loadu_pd(x), acc0);
+      acc1 = _mm256_fmadd_pd(c, _mm256_loadu_pd(x + 4), acc1);
+      acc2 = _mm256_fmadd_pd(c, _mm256_loadu_pd(x + 8), acc2);
+      acc3 = _mm256_fmadd_pd(c, _mm256_loadu_pd(x + 12), acc3);
+    }
+    sq = _mm256_fmadd_pd(acc0, acc0, sq);
+    sq = _mm256_fmadd_pd(acc1, acc1, sq);
+    sq = _mm256_fmadd_pd(acc2, acc2, sq);
+    sq = _mm256_fmadd_pd(acc3, acc3, sq);
+  }
+
+  for (; i + 4 <= end; i += 4) {
+    __m256d acc = _mm256_setzero_pd();
+    for (int j = order; j >= 0; j--) {
+      acc = _mm256_fmadd_pd(_mm256_broadcast_sd(&coeffs[j]), _mm256_loadu_pd(&input_signal[i - j]), acc);
+    }
+    sq = _mm256_fmadd_pd(acc, acc, sq);
+  }
+
+  double lanes[4];
+  _mm256_storeu_pd(lanes, sq);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+         fir_power_body_scalar(input_signal, order, coeffs, i, end);
+}
+
+// Same blocking as the AVX2 kernel with eight doubles per vector
+__attribute__((target("avx512f")))
+static double fir_power_body_avx512(double input_signal[], int order, double coeffs[],
+                                    long start, long end) {
+  __m512d sq = _mm512_setzero_pd();
+  long i = start;
+
+  for (; i + 32 <= end; i += 32) {
+    __m512d acc0 = _mm512_setzero_pd();
+    __m512d acc1 = _mm512_setzero_pd();
+    __m512d acc2 = _mm512_setzero_pd();
+    __m512d acc3 = _mm512_setzero_pd();
+    for (int j = order; j >= 0; j--) {
+      __m512d c = _mm512_set1_pd(coeffs[j]);
+      double* x = &input_signal[i - j];
+      acc0 = _mm512_fmadd_pd(c, _mm512_loadu_pd(x), acc0);
+      acc1 = _mm512_fmadd_pd(c, _mm512_loadu_pd(x + 8), acc1);
+      acc2 = _mm512_fmadd_pd(c, _mm512_loadu_pd(x + 16), acc2);
+      acc3 = _mm512_fmadd_pd(c, _mm512_loadu_pd(x + 24), acc3);
+    }
+    sq = _mm512_fmadd_pd(acc0, acc0, sq);
+    sq = _mm512_fmadd_pd(acc1, acc1, sq);
+    sq = _mm512_fmadd_pd(acc2, acc2, sq);
+    sq = _mm512_fmadd_pd(acc3, acc3, sq);
+  }
+
+  for (; i + 8 <= end; i += 8) {
+    __m512d acc = _mm512_setzero_pd();
+    for (int j = order; j >= 0; j--) {
+      acc = _mm512_fmadd_pd(_mm512_set1_pd(coeffs[j]), _mm512_loadu_pd(&input_signal[i - j]), acc);
+    }
+    sq = _mm512_fmadd_pd(acc, acc, sq);
+  }
+
+  return _mm512_reduce_add_pd(sq) +
+         fir_power_body_scalar(input_signal, order, coeffs, i, end);
+}
+
+__attribute__((target("avx2,fma")))
+static double fir_power_body_symmetric_avx2(double input_signal[], int order, double half[],
+                                            long start, long end) {
+  int h = order / 2;
+  __m256d sq = _mm256_setzero_pd();
+  long i = start;
+
+  for (; i + 16 <= end; i += 16) {
+    __m256d c    = _mm256_broadcast_sd(&half[h]);
+    double* xm   = &input_signal[i - h];
+    __m256d acc0 = _mm256_mul_pd(c, _mm256_loadu_pd(xm));
+    __m256d acc1 = _mm256_mul_pd(c, _mm256_loadu_pd(xm + 4));
+    __m256d acc2 = _mm256_mul_pd(c, _mm256_loadu_pd(xm + 8));
+    __m256d acc3 = _mm256_mul_pd(c, _mm256_loadu_pd(xm + 12));
+    for (int j = 0; j < h; j++) {
+      c = _mm256_broadcast_sd(&half[j]);
+      double* a = &input_signal[i - j];
+      double* b = &input_signal[i - order + j];
+      acc0 = _mm256_fmadd_pd(c, _mm256_add_pd(_mm256_loadu_pd(a), _mm256_loadu_pd(b)), acc0);
+      acc1 = _mm256_fmadd_pd(c, _mm256_add_pd(_mm256_loadu_pd(a + 4), _mm256_loadu_pd(b + 4)), acc1);
+      acc2 = _mm256_fmadd_pd(c, _mm256_add_pd(_mm256_loadu_pd(a + 8), _mm256_loadu_pd(b + 8)), acc2);
+      acc3 = _mm256_fmadd_pd(c, _mm256_add_pd(_mm256_loadu_pd(a + 12), _mm256_loadu_pd(b + 12)), acc3);
+    }
+    sq = _mm256_fmadd_pd(acc0, acc0, sq);
+    sq = _mm256_fmadd_pd(acc1, acc1, sq);
+    sq = _mm256_fmadd_pd(acc2, acc2, sq);
+    sq = _mm256_fmadd_pd(acc3, acc3, sq);
+  }
+
+  double lanes[4];
+  _mm256_storeu_pd(lanes, sq);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+         fir_power_body_symmetric_scalar(input_signal, order, half, i, end);
+}
+
+__attribute__((target("avx512f")))
+static double fir_power_body_symmetric_avx512(double input_signal[], int order, double half[],
+                                              long start, long end) {
+  int h = order / 2;
+  __m512d sq = _mm512_setzero_pd();
+  long i = start;
+
+  for (; i + 32 <= end; i += 32) {
+    __m512d c    = _mm512_set1_pd(half[h]);
+    double* xm   = &input_signal[i - h];
+    __m512d acc0 = _mm512_mul_pd(c, _mm512_loadu_pd(xm));
+    __m512d acc1 = _mm512_mul_pd(c, _mm512_loadu_pd(xm + 8));
+    __m512d acc2 = _mm512_mul_pd(c, _mm512_loadu_pd(xm + 16));
+    __m512d acc3 = _mm512_mul_pd(c, _mm512_loadu_pd(xm + 24));
+    for (int j = 0; j < h; j++) {
+      c = _mm512_set1_pd(half[j]);
+      double* a = &input_signal[i - j];
+      double* b = &input_signal[i - order + j];
+      acc0 = _mm512_fmadd_pd(c, _mm512_add_pd(_mm512_loadu_pd(a), _mm512_loadu_pd(b)), acc0);
+      acc1 = _mm512_fmadd_pd(c, _mm512_add_pd(_mm512_loadu_pd(a + 8), _mm512_loadu_pd(b + 8)), acc1);
+      acc2 = _mm512_fmadd_pd(c, _mm512_add_pd(_mm512_loadu_pd(a + 16), _mm512_loadu_pd(b + 16)), acc2);
+      acc3 = _mm512_fmadd_pd(c, _mm512_add_pd(_mm512_loadu_pd(a + 24), _mm512_loadu_pd(b + 24)), acc3);
+    }
+    sq = _mm512_fmadd_pd(acc0, acc0, sq);
+    sq = _mm512_fmadd_pd(acc1, acc1, sq);
+    sq = _mm512_fmadd_pd(acc2, acc2, sq);
+    sq = _mm512_fmadd_pd(acc3, acc3, sq);
+  }
+
+  return _mm512_reduce_add_pd(sq) +
+         fir_power_body_symmetric_scalar(input_signal, order, half, i, end);
+}
+
+#endif
+
+// Picks the widest kernels this processor supports, once
+// pthread_once, since engine workers can get here at the same time
+static pthread_once_t fir_power_body_once = PTHREAD_ONCE_INIT;
+static fir_power_body_fn fir_power_bodies[2];
+
+static void choose_fir_power_body(void) {
+  fir_power_bodies[0] = fir_power_body_scalar;
+  fir_power_bodies[1] = fir_power_body_symmetric_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    fir_power_bodies[0] = fir_power_body_avx512;
+    fir_power_bodies[1] = fir_power_body_symmetric_avx512;
+  } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    fir_power_bodies[0] = fir_power_body_avx2;
+    fir_power_bodies[1] = fir_power_body_symmetric_avx2;
+  }
+#endif
+}
+
+static fir_power_body_fn fir_power_body(int symmetric) {
+  pthread_once(&fir_power_body_once, choose_fir_power_body);
+  return fir_power_bodies[symmetric];
+}
+
+// Picks the body kernel for one filter and writes the taps it expects to
+// taps[] (order + 1 doubles): the folded half for symmetric filters, or a
+// copy of coeffs otherwise
+static fir_power_body_fn fir_power_prepare(int order, double coeffs[], double taps[]) {
+  if (is_symmetric(order, coeffs)) {
+    for (int j = 0; j < order / 2; j++) {
+      taps[j] = 0.5 * (coeffs[j] + coeffs[order - j]);
+    }
+    taps[order / 2] = coeffs[order / 2];
+    return fir_power_body(1);
+  }
+  for (int j = 0; j <= order; j++) {
+    taps[j] = coeffs[j];
+  }
+  return fir_power_body(0);
+}
+
+// Sum of squared outputs for start <= i < end, prologue and body combined
+// Symmetric filters are detected here and take the folded kernels
+static double fir_power_sum(long length, double input_signal[], int order, double coeffs[],
+                            long start, long end) {
+  long warm = order < end ? order : end;
+  double pow_sum = 0;
+  if (start < warm) {
+    pow_sum += fir_power_prologue(length, input_signal, order, coeffs, start, warm);
+    start = warm;
+  }
+  if (start < end) {
+    double taps[order + 1];
+    fir_power_body_fn body = fir_power_prepare(order, coeffs, taps);
+    pow_sum += body(input_signal, order, taps, start, end);
+  }
+  return pow_sum;
+}
+
+// Outputs per tile in the filter bank: the tile's input plus the order
+// samples of history behind it stay in L1 while every filter runs over it
+#define FIR_BANK_TILE 2048
+
+static int overlap_save(long length, double input_signal[],
+                        int order, int num_filters, double coeffs[],
+                        long start, long end,
+                        double output_signal[], double pow_sums[]);
+
 // Simple (slow) convolution
 // output must be same length as input.  coeffs assumed to be
-int convolve(int length, double input_signal[],
+int convolve(long length, double input_signal[],
              int order, double coeffs[],
              double output_signal[]) {
 
-  for (int i = 0; i < length; i++) {
-    output_signal[i] = 0;
+  if (order >= FFT_CROSSOVER_ORDER && length > order) {
+    return convolve_fft(length, input_signal, order, coeffs, output_signal);
+  }
+
+  // Warm up: use coeff only if there is input signal
+  // that matches, otherwise assume input signal
+  // is zero (aperiodic model)
+  long warm = order < length ? order : length;
+  for (long i = 0; i < warm; i++) {
+    double cur_sum = 0;
+    for (int j = i; j >= 0; j--) {
+      cur_sum += input_signal[i - j] * coeffs[j];
+    }
+    output_signal[i] = cur_sum;
+  }
+
+  // Causal model, use inputs up to this point
+  for (long i = warm; i < length; i++) {
+    double cur_sum = 0;
     for (int j = order; j >= 0; j--) {
-      // Use coeff only if there is input signal
-      // that matches, otherwise assume input signal
-      // is zero (aperiodic model)
-      if ((i - j) >= 0 && (i - j) < length) {
-        // Causal model, use inputs up to this point
-        output_signal[i] += input_signal[i - j] * coeffs[j];
-      }
+      cur_sum += input_signal[i - j] * coeffs[j];
     }
+    output_signal[i] = cur_sum;
   }
   return 0;
 }
 
 
 // Simple (slow) convolution combined with power estimate for output
-int convolve_and_compute_power(int length, double input_signal[],
+int convolve_and_compute_power(long length, double input_signal[],
                                int order, double coeffs[],
                                double* power) {
 
-  double pow_sum = 0;
+  if (order >= FFT_CROSSOVER_ORDER && length > order) {
+    return convolve_and_compute_power_fft(length, input_signal, order, coeffs, power);
+  }
 
-  for (int i = 0; i < length; i++) {
-    double cur_sum = 0;
+  // Inputs before the start are zero (aperiodic model), which only
+  // matters for the first order outputs
+  double pow_sum = fir_power_sum(length, input_signal, order, coeffs, 0, length);
+
+  *power = pow_sum / length;
+
+  return 0;
+}
+
+int convolve_bank_power_sums(long length, double input_signal[],
+                             int order, int num_filters,
+                             double coeffs[][order + 1],
+                             long start, long end, double pow_sums[]) {
+
+  if (order >= FFT_CROSSOVER_ORDER && end - start > order) {
+    return overlap_save(length, input_signal, order, num_filters, &coeffs[0][0],
+                        start, end, NULL, pow_sums);
+  }
+
+  double* taps = (double*)malloc(sizeof(double) * (order + 1) * (size_t)num_filters);
+  fir_power_body_fn body[num_filters];
+  if (!taps) {
+    return -1;
+  }
+
+  long warm = order < end ? order : end;
+  for (int f = 0; f < num_filters; f++) {
+    body[f] = fir_power_prepare(order, coeffs[f], &taps[(size_t)f * (order + 1)]);
+    if (start < warm) {
+      pow_sums[f] += fir_power_prologue(length, input_signal, order, coeffs[f], start, warm);
+    }
+  }
+  if (start < warm) {
+    start = warm;
+  }
+
+  // Every filter runs over a tile while it is still in L1
+  for (long i = start; i < end; i += FIR_BANK_TILE) {
+    long stop = (end - i > FIR_BANK_TILE) ? i + FIR_BANK_TILE : end;
+    for (int f = 0; f < num_filters; f++) {
+      pow_sums[f] += body[f](input_signal, order, &taps[(size_t)f * (order + 1)], i, stop);
+    }
+  }
+
+  free(taps);
+  return 0;
+}
+
+int convolve_bank_and_compute_power(long length, double input_signal[],
+                                    int order, int num_filters,
+                                    double coeffs[][order + 1],
+                                    double power[]) {
+
+  for (int f = 0; f < num_filters; f++) {
+    power[f] = 0;
+  }
+
+  if (convolve_bank_power_sums(length, input_signal, order, num_filters, coeffs,
+                               0, length, power)) {
+    return -1;
+  }
+
+  for (int f = 0; f < num_filters; f++) {
+    power[f] /= length;
+  }
+  return 0;
+}
+
+
+/* Single precision and 16-bit fixed point samples */
+
+// Same kernels for signals kept as float or int16_t, which fit two or four
+// times as many samples in a vector and a cache line. The f32 kernels keep
+// taps and each output's sum in float. The i16 kernels use 16-bit taps and
+// 32-bit sums (pmaddwd), with the taps scaled so the magnitudes of the
+// taps add up to at most 32767, so no output can overflow. Both square and
+// add up the outputs in double. i16 sample values are
+// scale * input_signal[i] - offset; the offset (the DC the scanners remove)
+// is corrected for afterwards from the sum of the outputs, since it can't
+// be taken off 16-bit samples in place.
+
+typedef double (*fir_power_body_f32_fn)(float input_signal[], int order, float taps[],
+                                        long start, long end);
+// returns the sum of squared outputs and adds the sum of outputs to *sum
+typedef double (*fir_power_body_i16_fn)(int16_t input_signal[], int order, int32_t pairs[],
+                                        long start, long end, double* sum);
+
+// High orders widen this many samples at a time (at least 16 orders) to
+// double and take the FFT path
+#define NARROW_CHUNK 65536
+
+static double fir_power_body_f32_scalar(float input_signal[], int order, float taps[],
+                                        long start, long end) {
+  double pow_sum = 0;
+  for (long i = start; i < end; i++) {
+    float cur_sum = 0;
     for (int j = order; j >= 0; j--) {
-      // Use coeff only if there is input signal
-      // that matches, otherwise assume input signal
-      // is zero (aperiodic model)
-      if ((i - j) >= 0 && (i - j) < length) {
-        // Causal model, use inputs up to this point
-        cur_sum += input_signal[i - j] * coeffs[j];
+      cur_sum += input_signal[i - j] * taps[j];
+    }
+    pow_sum += (double)cur_sum * cur_sum;
+  }
+  return pow_sum;
+}
+
+// pairs[k] packs taps 2k and 2k + 1 as the low and high halves, the way
+// pmaddwd wants them; pairs[order / 2] has the last tap alone
+static double fir_power_body_i16_scalar(int16_t input_signal[], int order, int32_t pairs[],
+                                        long start, long end, double* sum) {
+  double pow_sum = 0;
+  for (long i = start; i < end; i++) {
+    int32_t cur_sum = 0;
+    for (int k = 0; k <= order / 2; k++) {
+      int16_t lo = (int16_t)(pairs[k] & 0xffff);
+      int16_t hi = (int16_t)(pairs[k] >> 16);
+      cur_sum += lo * input_signal[i - 2 * k];
+      if (2 * k + 1 <= order) {
+        cur_sum += hi * input_signal[i - 2 * k - 1];
       }
     }
-    pow_sum += cur_sum * cur_sum;
+    pow_sum += (double)cur_sum * cur_sum;
+    *sum    += cur_sum;
   }
+  return pow_sum;
+}
 
-  *power = pow_sum / length;
+#if defined(__x86_64__) || defined(__i386__)
 
-  return 0;
+__attribute__((target("avx2,fma")))
+static inline __m256d add_squares_ps_avx2(__m256 v, __m256d sq) {
+  __m256d lo = _mm256_cvtps_pd(_mm256_castps256_ps128(v));
+  __m256d hi = _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1));
+  sq = _mm256_fmadd_pd(lo, lo, sq);
+  return _mm256_fmadd_pd(hi, hi, sq);
+}
+
+// 32 outputs per pass: four vectors of eight
+__attribute__((target("avx2,fma")))
+static double fir_power_body_f32_avx2(float input_signal[], int order, float taps[],
+                                      long start, long end) {
+  __m256d sq = _mm256_setzero_pd();
+  long i = start;
+
+  for (; i + 32 <= end; i += 32) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    for (int j = order; j >= 0; j--) {
+      __m256 c = _mm256_broadcast_ss(&taps[j]);
+      float* x = &input_signal[i - j];
+      acc0 = _mm256_fmadd_ps(c, _mm256_loadu_ps(x), acc0);
+      acc1 = _mm256_fmadd_ps(c, _mm256_loadu_ps(x + 8), acc1);
+      acc2 = _mm256_fmadd_ps(c, _mm256_loadu_ps(x + 16), acc2);
+      acc3 = _mm256_fmadd_ps(c, _mm256_loadu_ps(x + 24), acc3);
+    }
+    sq = add_squares_ps_avx2(acc0, sq);
+    sq = add_squares_ps_avx2(acc1, sq);
+    sq = add_squares_ps_avx2(acc2, sq);
+    sq = add_squares_ps_avx2(acc3, sq);
+  }
+
+  for (; i + 8 <= end; i += 8) {
+    __m256 acc = _mm256_setzero_ps();
+    for (int j = order; j >= 0; j--) {
+      acc = _mm256_fmadd_ps(_mm256_broadcast_ss(&taps[j]), _mm256_loadu_ps(&input_signal[i - j]), acc);
+    }
+    sq = add_squares_ps_avx2(acc, sq);
+  }
+
+  double lanes[4];
+  _mm256_storeu_pd(lanes, sq);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+         fir_power_body_f32_scalar(input_signal, order, taps, i, end);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d add_squares_ps_avx512(__m512 v, __m512d sq) {
+  __m512d lo = _mm512_cvtps_pd(_mm512_castps512_ps256(v));
+  __m512d hi = _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1)));
+  sq = _mm512_fmadd_pd(lo, lo, sq);
+  return _mm512_fmadd_pd(hi, hi, sq);
+}
+
+// Same blocking as the AVX2 kernel with sixteen floats per vector
+__attribute__((target("avx512f")))
+static double fir_power_body_f32_avx512(float input_signal[], int order, float taps[],
+                                        long start, long end) {
+  __m512d sq = _mm512_setzero_pd();
+  long i = start;
+
+  for (; i + 64 <= end; i += 64) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    __m512 acc2 = _mm512_setzero_ps();
+    __m512 acc3 = _mm512_setzero_ps();
+    for (int j = order; j >= 0; j--) {
+      __m512 c = _mm512_set1_ps(taps[j]);
+      float* x = &input_signal[i - j];
+      acc0 = _mm512_fmadd_ps(c, _mm512_loadu_ps(x), acc0);
+      acc1 = _mm512_fmadd_ps(c, _mm512_loadu_ps(x + 16), acc1);
+      acc2 = _mm512_fmadd_ps(c, _mm512_loadu_ps(x + 32), acc2);
+      acc3 = _mm512_fmadd_ps(c, _mm512_loadu_ps(x + 48), acc3);
+    }
+    sq = add_squares_ps_avx512(acc0, sq);
+    sq = add_squares_ps_avx512(acc1, sq);
+    sq = add_squares_ps_avx512(acc2, sq);
+    sq = add_squares_ps_avx512(acc3, sq);
+  }
+
+  for (; i + 16 <= end; i += 16) {
+    __m512 acc = _mm512_setzero_ps();
+    for (int j = order; j >= 0; j--) {
+      acc = _mm512_fmadd_ps(_mm512_set1_ps(taps[j]), _mm512_loadu_ps(&input_signal[i - j]), acc);
+    }
+    sq = add_squares_ps_avx512(acc, sq);
+  }
+
+  return _mm512_reduce_add_pd(sq) +
+         fir_power_body_f32_scalar(input_signal, order, taps, i, end);
+}
+
+// Adds the squares and the values of eight 32-bit outputs
+__attribute__((target("avx2,fma")))
+static inline __m256d add_squares_epi32_avx2(__m256i v, __m256d sq, __m256d* sum) {
+  __m256d lo = _mm256_cvtepi32_pd(_mm256_castsi256_si128(v));
+  __m256d hi = _mm256_cvtepi32_pd(_mm256_extracti128_si256(v, 1));
+  *sum = _mm256_add_pd(*sum, _mm256_add_pd(lo, hi));
+  sq = _mm256_fmadd_pd(lo, lo, sq);
+  return _mm256_fmadd_pd(hi, hi, sq);
+}
+
+// 16 outputs per pass. Interleaving the inputs at i - 2k and i - 2k - 1
+// gives each 32-bit lane one output's pair of samples for a tap pair, so
+// one pmaddwd does two taps of eight outputs. Lanes come out permuted,
+// which doesn't matter for sums.
+__attribute__((target("avx2,fma")))
+static double fir_power_body_i16_avx2(int16_t input_signal[], int order, int32_t pairs[],
+                                      long start, long end, double* sum) {
+  __m256d sq = _mm256_setzero_pd();
+  __m256d s1 = _mm256_setzero_pd();
+  __m256i zero = _mm256_setzero_si256();
+  int h = order / 2;
+  long i = start;
+
+  for (; i + 16 <= end; i += 16) {
+    __m256i lo = _mm256_setzero_si256();
+    __m256i hi = _mm256_setzero_si256();
+    for (int k = 0; k < h; k++) {
+      __m256i c = _mm256_set1_epi32(pairs[k]);
+      __m256i a = _mm256_loadu_si256((__m256i*)&input_signal[i - 2 * k]);
+      __m256i b = _mm256_loadu_si256((__m256i*)&input_signal[i - 2 * k - 1]);
+      lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), c));
+      hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), c));
+    }
+    // the last tap, paired with zeros
+    __m256i c = _mm256_set1_epi32(pairs[h]);
+    __m256i a = _mm256_loadu_si256((__m256i*)&input_signal[i - order]);
+    lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, zero), c));
+    hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, zero), c));
+
+    sq = add_squares_epi32_avx2(lo, sq, &s1);
+    sq = add_squares_epi32_avx2(hi, sq, &s1);
+  }
+
+  double lanes[4];
+  _mm256_storeu_pd(lanes, s1);
+  *sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  _mm256_storeu_pd(lanes, sq);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+         fir_power_body_i16_scalar(input_signal, order, pairs, i, end, sum);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512d add_squares_epi32_avx512(__m512i v, __m512d sq, __m512d* sum) {
+  __m512d lo = _mm512_cvtepi32_pd(_mm512_castsi512_si256(v));
+  __m512d hi = _mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(v, 1));
+  *sum = _mm512_add_pd(*sum, _mm512_add_pd(lo, hi));
+  sq = _mm512_fmadd_pd(lo, lo, sq);
+  return _mm512_fmadd_pd(hi, hi, sq);
+}
+
+// Same as the AVX2 kernel with 32 outputs per pass
+__attribute__((target("avx512f,avx512bw")))
+static double fir_power_body_i16_avx512(int16_t input_signal[], int order, int32_t pairs[],
+                                        long start, long end, double* sum) {
+  __m512d sq = _mm512_setzero_pd();
+  __m512d s1 = _mm512_setzero_pd();
+  __m512i zero = _mm512_setzero_si512();
+  int h = order / 2;
+  long i = start;
+
+  for (; i + 32 <= end; i += 32) {
+    __m512i lo = _mm512_setzero_si512();
+    __m512i hi = _mm512_setzero_si512();
+    for (int k = 0; k < h; k++) {
+      __m512i c = _mm512_set1_epi32(pairs[k]);
+      __m512i a = _mm512_loadu_si512(&input_signal[i - 2 * k]);
+      __m512i b = _mm512_loadu_si512(&input_signal[i - 2 * k - 1]);
+      lo = _mm512_add_epi32(lo, _mm512_madd_epi16(_mm512_unpacklo_epi16(a, b), c));
+      hi = _mm512_add_epi32(hi, _mm512_madd_epi16(_mm512_unpackhi_epi16(a, b), c));
+    }
+    __m512i c = _mm512_set1_epi32(pairs[h]);
+    __m512i a = _mm512_loadu_si512(&input_signal[i - order]);
+    lo = _mm512_add_epi32(lo, _mm512_madd_epi16(_mm512_unpacklo_epi16(a, zero), c));
+    hi = _mm512_add_epi32(hi, _mm512_madd_epi16(_mm512_unpackhi_epi16(a, zero), c));
+
+    sq = add_squares_epi32_avx512(lo, sq, &s1);
+    sq = add_squares_epi32_avx512(hi, sq, &s1);
+  }
+
+  *sum += _mm512_reduce_add_pd(s1);
+  return _mm512_reduce_add_pd(sq) +
+         fir_power_body_i16_scalar(input_signal, order, pairs, i, end, sum);
+}
+
+#endif
+
+static pthread_once_t fir_power_body_f32_once = PTHREAD_ONCE_INIT;
+static fir_power_body_f32_fn fir_power_body_f32_kernel;
+
+static void choose_fir_power_body_f32(void) {
+  fir_power_body_f32_kernel = fir_power_body_f32_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    fir_power_body_f32_kernel = fir_power_body_f32_avx512;
+  } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    fir_power_body_f32_kernel = fir_power_body_f32_avx2;
+  }
+#endif
+}
+
+static fir_power_body_f32_fn fir_power_body_f32(void) {
+  pthread_once(&fir_power_body_f32_once, choose_fir_power_body_f32);
+  return fir_power_body_f32_kernel;
 }
 
+static pthread_once_t fir_power_body_i16_once = PTHREAD_ONCE_INIT;
+static fir_power_body_i16_fn fir_power_body_i16_kernel;
+
+static void choose_fir_power_body_i16(void) {
+  fir_power_body_i16_kernel = fir_power_body_i16_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+    fir_power_body_i16_kernel = fir_power_body_i16_avx512;
+  } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    fir_power_body_i16_kernel = fir_power_body_i16_avx2;
+  }
+#endif
+}
+
+static fir_power_body_i16_fn fir_power_body_i16(void) {
+  pthread_once(&fir_power_body_i16_once, choose_fir_power_body_i16);
+  return fir_power_body_i16_kernel;
+}
+
+// Quantizes one filter for the i16 kernels into pairs[] (order / 2 + 1)
+// Returns the value of one tap unit
+static double quantize_taps(int order, double coeffs[], int32_t pairs[]) {
+  double l1 = 0;
+  for (int j = 0; j <= order; j++) {
+    l1 += fabs(coeffs[j]);
+  }
+  if (l1 == 0) {
+    l1 = 1;
+  }
+  // rounding can add up to half a unit per tap
+  double unit = l1 / (INT16_MAX - (order + 1) / 2);
+  for (int k = 0; k <= order / 2; k++) {
+    int16_t lo = (int16_t)lround(coeffs[2 * k] / unit);
+    int16_t hi = (2 * k + 1 <= order) ? (int16_t)lround(coeffs[2 * k + 1] / unit) : 0;
+    pairs[k] = (int32_t)((uint32_t)(uint16_t)lo | ((uint32_t)(uint16_t)hi << 16));
+  }
+  return unit;
+}
+
+// value of sample i of a narrow signal
+static inline double narrow_value(float xf[], int16_t xi[], double scale, double offset, long i) {
+  return xf ? xf[i] : scale * xi[i] - offset;
+}
+
+// convolve_bank_power_sums() of either narrow type (xf or xi is NULL)
+static int narrow_bank_power_sums(long length, float xf[], int16_t xi[],
+                                  double scale, double offset,
+                                  int order, int num_filters,
+                                  double coeffs[][order + 1],
+                                  long start, long end, double pow_sums[]) {
+
+  // High orders go to the FFT, on double pieces widened a chunk at a time
+  if (order >= FFT_CROSSOVER_ORDER && end - start > order) {
+    long chunk = (long)16 * order > NARROW_CHUNK ? (long)16 * order : NARROW_CHUNK;
+    double* wide = (double*)malloc(sizeof(double) * (chunk + order));
+    if (!wide) {
+      return -1;
+    }
+    for (long s = start; s < end; s += chunk) {
+      long e  = (end - s > chunk) ? s + chunk : end;
+      long lo = (s > order) ? s - order : 0;
+      for (long i = lo; i < e; i++) {
+        wide[i - lo] = narrow_value(xf, xi, scale, offset, i);
+      }
+      // with lo == 0 the warm up outputs are still at their own index
+      if (convolve_bank_power_sums(e - lo, wide, order, num_filters, coeffs,
+                                   s - lo, e - lo, pow_sums)) {
+        free(wide);
+        return -1;
+      }
+    }
+    free(wide);
+    return 0;
+  }
+
+  // the warm up in double, from the first order samples
+  long warm = order < end ? order : end;
+  if (start < warm) {
+    double head[warm];
+    for (long i = 0; i < warm; i++) {
+      head[i] = narrow_value(xf, xi, scale, offset, i);
+    }
+    for (int f = 0; f < num_filters; f++) {
+      pow_sums[f] += fir_power_prologue(length, head, order, coeffs[f], start, warm);
+    }
+    start = warm;
+  }
+  if (start >= end) {
+    return 0;
+  }
+
+  if (xf) {
+    float* taps = (float*)malloc(sizeof(float) * (order + 1) * (size_t)num_filters);
+    if (!taps) {
+      return -1;
+    }
+    for (int f = 0; f < num_filters; f++) {
+      for (int j = 0; j <= order; j++) {
+        taps[(size_t)f * (order + 1) + j] = (float)coeffs[f][j];
+      }
+    }
+    fir_power_body_f32_fn body = fir_power_body_f32();
+    for (long i = start; i < end; i += FIR_BANK_TILE) {
+      long stop = (end - i > FIR_BANK_TILE) ? i + FIR_BANK_TILE : end;
+      for (int f = 0; f < num_filters; f++) {
+        pow_sums[f] += body(xf, order, &taps[(size_t)f * (order + 1)], i, stop);
+      }
+    }
+    free(taps);
+    return 0;
+  }
+
+  int h = order / 2;
+  int32_t* pairs = (int32_t*)malloc(sizeof(int32_t) * (h + 1) * (size_t)num_filters);
+  if (!pairs) {
+    return -1;
+  }
+  double gain[num_filters];  // output value per integer output unit
+  double dc[num_filters];    // what offset adds to every output, per unit of it
+  for (int f = 0; f < num_filters; f++) {
+    double unit = quantize_taps(order, coeffs[f], &pairs[(size_t)f * (h + 1)]);
+    long q_sum = 0;
+    for (int k = 0; k <= h; k++) {
+      q_sum += (int16_t)(pairs[(size_t)f * (h + 1) + k] & 0xffff) +
+               (int16_t)(pairs[(size_t)f * (h + 1) + k] >> 16);
+    }
+    gain[f] = scale * unit;
+    dc[f]   = unit * q_sum;
+  }
+
+  // y = gain * y_q - offset * dc, so
+  // sum y^2 = gain^2 sum y_q^2 - 2 gain offset dc sum y_q + n (offset dc)^2
+  fir_power_body_i16_fn body = fir_power_body_i16();
+  for (long i = start; i < end; i += FIR_BANK_TILE) {
+    long stop = (end - i > FIR_BANK_TILE) ? i + FIR_BANK_TILE : end;
+    for (int f = 0; f < num_filters; f++) {
+      double sum = 0;
+      double sum_squares = body(xi, order, &pairs[(size_t)f * (h + 1)], i, stop, &sum);
+      double shift = offset * dc[f];
+      pow_sums[f] += gain[f] * gain[f] * sum_squares - 2 * gain[f] * shift * sum +
+                     (stop - i) * shift * shift;
+    }
+  }
+  free(pairs);
+  return 0;
+}
+
+int convolve_bank_power_sums_f32(long length, float input_signal[],
+                                 int order, int num_filters,
+                                 double coeffs[][order + 1],
+                                 long start, long end, double pow_sums[]) {
+  return narrow_bank_power_sums(length, input_signal, NULL, 1, 0, order, num_filters,
+                                coeffs, start, end, pow_sums);
+}
+
+int convolve_bank_power_sums_i16(long length, int16_t input_signal[],
+                                 double scale, double offset,
+                                 int order, int num_filters,
+                                 double coeffs[][order + 1],
+                                 long start, long end, double pow_sums[]) {
+  return narrow_bank_power_sums(length, NULL, input_signal, scale, offset, order, num_filters,
+                                coeffs, start, end, pow_sums);
+}
+
+int convolve_bank_and_compute_power_f32(long length, float input_signal[],
+                                        int order, int num_filters,
+                                        double coeffs[][order + 1],
+                                        double power[]) {
+  for (int f = 0; f < num_filters; f++) {
+    power[f] = 0;
+  }
+  if (convolve_bank_power_sums_f32(length, input_signal, order, num_filters, coeffs,
+                                   0, length, power)) {
+    return -1;
+  }
+  for (int f = 0; f < num_filters; f++) {
+    power[f] /= length;
+  }
+  return 0;
+}
+
+int convolve_bank_and_compute_power_i16(long length, int16_t input_signal[],
+                                        double scale, double offset,
+                                        int order, int num_filters,
+                                        double coeffs[][order + 1],
+                                        double power[]) {
+  for (int f = 0; f < num_filters; f++) {
+    power[f] = 0;
+  }
+  if (convolve_bank_power_sums_i16(length, input_signal, scale, offset, order, num_filters,
+                                   coeffs, 0, length, power)) {
+    return -1;
+  }
+  for (int f = 0; f < num_filters; f++) {
+    power[f] /= length;
+  }
+  return 0;
+}
+
+int convolve_and_compute_power_f32(long length, float input_signal[],
+                                   int order, double coeffs[],
+                                   double* power) {
+  return convolve_bank_and_compute_power_f32(length, input_signal, order, 1,
+                                             (double (*)[order + 1])coeffs, power);
+}
+
+int convolve_and_compute_power_i16(long length, int16_t input_signal[],
+                                   double scale, double offset,
+                                   int order, double coeffs[],
+                                   double* power) {
+  return convolve_bank_and_compute_power_i16(length, input_signal, scale, offset, order, 1,
+                                             (double (*)[order + 1])coeffs, power);
+}
+
+
+/* Streaming filter bank */
+
+// Samples arrive in blocks. work[] holds the last order samples of history
+// followed by the newest block, so the body kernels see every tap's input.
+//
+// The DC removal the scanners do up front needs the mean of the whole
+// signal, which a stream only knows at the end. With mu that mean and
+// y'[n] the filter output for the raw samples,
+//   y[n] = y'[n] - mu S[n],   S[n] = sum_{j <= min(n, order)} coeffs[j]
+// so
+//   sum y^2 = sum y'^2 - 2 mu sum y' S + mu^2 sum S^2
+// S[n] is the full coefficient sum C past the first order outputs, where
+// sum y' follows from the total, the first order and the last order samples.
+// To keep the cancellation small, the samples are fed in with the first
+// block's mean already taken off, and mu is what remains of the mean.
+
+struct fir_stream_ {
+  int order;
+  int num_filters;
+  double* coeffs;   // num_filters x (order + 1)
+  double* taps;     // prepared for body[]
+  fir_power_body_fn* body;
+
+  double* work;     // order history + block
+  long capacity;    // samples of block room in work
+  double* head;     // first order samples
+  long total;       // samples so far
+  double offset;    // first block's mean, taken off every sample
+  double sum_x;     // of the offset samples
+  double sum_x2;
+
+  double* sum_y2;   // per filter, all outputs
+  double* sum_yS;   // per filter, first order outputs only
+  double* sum_S2;   // per filter, first order outputs only
+};
+
+fir_stream* fir_stream_create(int order, int num_filters, double coeffs[][order + 1]) {
+
+  fir_stream* s = (fir_stream*)calloc(1, sizeof(fir_stream));
+  if (!s) {
+    return 0;
+  }
+  s->order       = order;
+  s->num_filters = num_filters;
+  s->coeffs = (double*)malloc(sizeof(double) * (order + 1) * num_filters);
+  s->taps   = (double*)malloc(sizeof(double) * (order + 1) * num_filters);
+  s->body   = (fir_power_body_fn*)malloc(sizeof(fir_power_body_fn) * num_filters);
+  s->work   = (double*)calloc(order, sizeof(double));
+  s->head   = (double*)calloc(order, sizeof(double));
+  s->sum_y2 = (double*)calloc(num_filters, sizeof(double));
+  s->sum_yS = (double*)calloc(num_filters, sizeof(double));
+  s->sum_S2 = (double*)calloc(num_filters, sizeof(double));
+  if (!s->coeffs || !s->taps || !s->body || !s->work || !s->head ||
+      !s->sum_y2 || !s->sum_yS || !s->sum_S2) {
+    fir_stream_destroy(s);
+    return 0;
+  }
+
+  for (int f = 0; f < num_filters; f++) {
+    for (int j = 0; j <= order; j++) {
+      s->coeffs[f * (order + 1) + j] = coeffs[f][j];
+    }
+    s->body[f] = fir_power_prepare(order, coeffs[f], &(s->taps[f * (order + 1)]));
+  }
+  return s;
+}
+
+void fir_stream_destroy(fir_stream* s) {
+  if (s) {
+    free(s->coeffs);
+    free(s->taps);
+    free(s->body);
+    free(s->work);
+    free(s->head);
+    free(s->sum_y2);
+    free(s->sum_yS);
+    free(s->sum_S2);
+    free(s);
+  }
+}
+
+int fir_stream_push(fir_stream* s, long count, double samples[]) {
+
+  int order = s->order;
+  if (count <= 0) {
+    return 0;
+  }
+
+  if (s->total == 0) {
+    double sum = 0;
+    for (long i = 0; i < count; i++) {
+      sum += samples[i];
+    }
+    s->offset = sum / count;
+  }
+
+  if (count > s->capacity) {
+    double* w = (double*)realloc(s->work, sizeof(double) * (order + count));
+    if (!w) {
+      return -1;
+    }
+    s->work     = w;
+    s->capacity = count;
+  }
+
+  // work[order + i] is sample total + i; work[order - k] is sample total - k
+  double* x = &(s->work[order]);
+  for (long i = 0; i < count; i++) {
+    x[i] = samples[i] - s->offset;
+    s->sum_x  += x[i];
+    s->sum_x2 += x[i] * x[i];
+    if (s->total + i < order) {
+      s->head[s->total + i] = x[i];
+    }
+  }
+
+  // first order outputs of the signal, with zero history
+  long warm = order - s->total;
+  if (warm > count) {
+    warm = count;
+  }
+  for (long i = 0; i < warm; i++) {
+    long n = s->total + i;
+    for (int f = 0; f < s->num_filters; f++) {
+      double* c = &(s->coeffs[f * (order + 1)]);
+      double y  = 0;
+      double S  = 0;
+      for (long j = 0; j <= n; j++) {
+        y += c[j] * x[i - j];
+        S += c[j];
+      }
+      s->sum_y2[f] += y * y;
+      s->sum_yS[f] += y * S;
+      s->sum_S2[f] += S * S;
+    }
+  }
+
+  // the rest, every tap has input behind it
+  if (warm < 0) {
+    warm = 0;
+  }
+  if (warm < count) {
+    if (order >= FFT_CROSSOVER_ORDER && count - warm > order) {
+      if (overlap_save(order + count, s->work, order, s->num_filters, s->coeffs,
+                       order + warm, order + count, NULL, s->sum_y2)) {
+        return -1;
+      }
+    } else {
+      for (long i = order + warm; i < order + count; i += FIR_BANK_TILE) {
+        long stop = (order + count - i > FIR_BANK_TILE) ? i + FIR_BANK_TILE : order + count;
+        for (int f = 0; f < s->num_filters; f++) {
+          s->sum_y2[f] += s->body[f](s->work, order, &(s->taps[f * (order + 1)]), i, stop);
+        }
+      }
+    }
+  }
+
+  // the last order samples become the next block's history
+  memmove(s->work, &(s->work[count]), sizeof(double) * order);
+  s->total += count;
+  return 0;
+}
+
+long fir_stream_samples(fir_stream* s) {
+  return s->total;
+}
+
+double fir_stream_mean(fir_stream* s) {
+  return s->total ? s->offset + s->sum_x / s->total : 0;
+}
+
+double fir_stream_signal_power(fir_stream* s, int remove_dc) {
+  if (!s->total) {
+    return 0;
+  }
+  double mean = s->sum_x / s->total;
+  double ac   = s->sum_x2 / s->total - mean * mean;
+  if (remove_dc) {
+    return ac;
+  }
+  double dc = s->offset + mean;
+  return ac + dc * dc;
+}
+
+int fir_stream_power(fir_stream* s, int remove_dc, double power[]) {
+
+  int order = s->order;
+  long N    = s->total;
+  if (N == 0) {
+    return -1;
+  }
+
+  // the offset is already off the samples, mu is the rest of the DC
+  double mu = remove_dc ? s->sum_x / N : -s->offset;
+
+  for (int f = 0; f < s->num_filters; f++) {
+    double* c    = &(s->coeffs[f * (order + 1)]);
+    double sum_yS = s->sum_yS[f];
+    double sum_S2 = s->sum_S2[f];
+
+    if (N > order) {
+      // sum of y'[n] for n >= order: tap j sees samples order - j ... N - 1 - j
+      // the work history holds samples N - order ... N - 1
+      double C = 0;
+      double sum_y = 0;
+      double head = 0; // samples 0 ... order - j - 1
+      double tail = 0; // samples N - j ... N - 1
+      for (int j = 0; j < order; j++) {
+        head += s->head[j];
+      }
+      for (int j = 0; j <= order; j++) {
+        sum_y += c[j] * (s->sum_x - head - tail);
+        C     += c[j];
+        if (j < order) {
+          head -= s->head[order - j - 1];
+          tail += s->work[order - j - 1];
+        }
+      }
+      sum_yS += C * sum_y;
+      sum_S2 += (N - order) * C * C;
+    }
+
+    power[f] = (s->sum_y2[f] - 2 * mu * sum_yS + mu * mu * sum_S2) / N;
+  }
+  return 0;
+}
+
+
+/* FFT and overlap-save convolution */
+
+struct fft_plan_ {
+  int n;              // transform size
+  double* twiddle;    // n/2 complex roots e^(-2 pi i k / n), power of two sizes
+  int* bitrev;        // bit reversal permutation, power of two sizes
+
+  // Bluestein's algorithm, other sizes
+  fft_plan* sub;      // power of two plan of at least 2n-1 points
+  double* chirp;      // n complex e^(-pi i k^2 / n)
+  double* chirp_fft;  // forward transform of the conjugate chirp filter
+  double* work;       // sub->n complex of scratch
+};
+
+static int is_power_of_two(int n) {
+  return n > 0 && !(n & (n - 1));
+}
+
+static int next_power_of_two(int n) {
+  int p = 1;
+  while (p < n) {
+    p <<= 1;
+  }
+  return p;
+}
+
+static void fft_radix2(fft_plan* plan, double d[]) {
+  int n = plan->n;
+
+  for (int i = 0; i < n; i++) {
+    int j = plan->bitrev[i];
+    if (i < j) {
+      double tr = d[2 * i];
+      double ti = d[2 * i + 1];
+      d[2 * i]     = d[2 * j];
+      d[2 * i + 1] = d[2 * j + 1];
+      d[2 * j]     = tr;
+      d[2 * j + 1] = ti;
+    }
+  }
+
+  for (int len = 2; len <= n; len <<= 1) {
+    int half = len / 2;
+    int step = n / len;
+    for (int i = 0; i < n; i += len) {
+      for (int k = 0; k < half; k++) {
+        double wr = plan->twiddle[2 * k * step];
+        double wi = plan->twiddle[2 * k * step + 1];
+        int a = i + k;
+        int b = a + half;
+        double xr = d[2 * b] * wr - d[2 * b + 1] * wi;
+        double xi = d[2 * b] * wi + d[2 * b + 1] * wr;
+        d[2 * b]     = d[2 * a] - xr;
+        d[2 * b + 1] = d[2 * a + 1] - xi;
+        d[2 * a]     += xr;
+        d[2 * a + 1] += xi;
+      }
+    }
+  }
+}
+
+static void fft_bluestein(fft_plan* plan, double d[]) {
+  int n = plan->n;
+  int m = plan->sub->n;
+  double* w = plan->work;
+
+  for (int k = 0; k < n; k++) {
+    double cr = plan->chirp[2 * k];
+    double ci = plan->chirp[2 * k + 1];
+    w[2 * k]     = d[2 * k] * cr - d[2 * k + 1] * ci;
+    w[2 * k + 1] = d[2 * k] * ci + d[2 * k + 1] * cr;
+  }
+  for (int k = 2 * n; k < 2 * m; k++) {
+    w[k] = 0;
+  }
+
+  fft_execute(plan->sub, w, 0);
+  for (int k = 0; k < m; k++) {
+    double br = plan->chirp_fft[2 * k];
+    double bi = plan->chirp_fft[2 * k + 1];
+    double xr = w[2 * k] * br - w[2 * k + 1] * bi;
+    double xi = w[2 * k] * bi + w[2 * k + 1] * br;
+    w[2 * k]     = xr;
+    w[2 * k + 1] = xi;
+  }
+  fft_execute(plan->sub, w, 1);
+
+  for (int k = 0; k < n; k++) {
+    double cr = plan->chirp[2 * k];
+    double ci = plan->chirp[2 * k + 1];
+    double xr = w[2 * k] / m;
+    double xi = w[2 * k + 1] / m;
+    d[2 * k]     = xr * cr - xi * ci;
+    d[2 * k + 1] = xr * ci + xi * cr;
+  }
+}
+
+fft_plan* fft_plan_create(int n) {
+  assert(n > 0);
+
+  fft_plan* plan = (fft_plan*)calloc(1, sizeof(fft_plan));
+  if (!plan) {
+    return NULL;
+  }
+  plan->n = n;
+
+  if (is_power_of_two(n)) {
+    plan->twiddle = (double*)malloc(sizeof(double) * (n > 1 ? n : 2));
+    plan->bitrev  = (int*)malloc(sizeof(int) * n);
+    if (!plan->twiddle || !plan->bitrev) {
+      fft_plan_destroy(plan);
+      return NULL;
+    }
+    for (int k = 0; k < n / 2; k++) {
+      plan->twiddle[2 * k]     = cos(2 * M_PI * k / n);
+      plan->twiddle[2 * k + 1] = -sin(2 * M_PI * k / n);
+    }
+    int bits = 0;
+    while ((1 << bits) < n) {
+      bits++;
+    }
+    for (int i = 0; i < n; i++) {
+      int r = 0;
+      for (int b = 0; b < bits; b++) {
+        r |= ((i >> b) & 1) << (bits - 1 - b);
+      }
+      plan->bitrev[i] = r;
+    }
+    return plan;
+  }
+
+  int m = next_power_of_two(2 * n - 1);
+  plan->sub       = fft_plan_create(m);
+  plan->chirp     = (double*)malloc(sizeof(double) * 2 * n);
+  plan->chirp_fft = (double*)calloc(2 * m, sizeof(double));
+  plan->work      = (double*)malloc(sizeof(double) * 2 * m);
+  if (!plan->sub || !plan->chirp || !plan->chirp_fft || !plan->work) {
+    fft_plan_destroy(plan);
+    return NULL;
+  }
+
+  for (int k = 0; k < n; k++) {
+    // k^2 mod 2n keeps the angle small and accurate for large k
+    double angle = M_PI * (double)(((long long)k * k) % (2LL * n)) / n;
+    plan->chirp[2 * k]     = cos(angle);
+    plan->chirp[2 * k + 1] = -sin(angle);
+  }
+  for (int k = 0; k < n; k++) {
+    plan->chirp_fft[2 * k]     = plan->chirp[2 * k];
+    plan->chirp_fft[2 * k + 1] = -plan->chirp[2 * k + 1];
+    if (k > 0) {
+      plan->chirp_fft[2 * (m - k)]     = plan->chirp[2 * k];
+      plan->chirp_fft[2 * (m - k) + 1] = -plan->chirp[2 * k + 1];
+    }
+  }
+  fft_execute(plan->sub, plan->chirp_fft, 0);
+
+  return plan;
+}
+
+void fft_plan_destroy(fft_plan* plan) {
+  if (plan) {
+    free(plan->twiddle);
+    free(plan->bitrev);
+    fft_plan_destroy(plan->sub);
+    free(plan->chirp);
+    free(plan->chirp_fft);
+    free(plan->work);
+    free(plan);
+  }
+}
+
+void fft_execute(fft_plan* plan, double data[], int inverse) {
+  int n = plan->n;
+
+  // inverse(x) = conj(forward(conj(x)))
+  if (inverse) {
+    for (int k = 0; k < n; k++) {
+      data[2 * k + 1] = -data[2 * k + 1];
+    }
+  }
+
+  if (plan->sub) {
+    fft_bluestein(plan, data);
+  } else {
+    fft_radix2(plan, data);
+  }
+
+  if (inverse) {
+    for (int k = 0; k < n; k++) {
+      data[2 * k + 1] = -data[2 * k + 1];
+    }
+  }
+}
+
+// Overlap-save convolution with a causal, zero history model
+// coeffs holds num_filters filters of order + 1 taps each, one after another.
+// Only outputs start <= i < end are produced; the blocks still read the
+// order inputs of history before start.
+// Writes outputs to output_signal if it is not NULL (one filter only), and
+// adds each filter's sum of squared outputs to pow_sums[] if that is not NULL
+//
+// The filters are real, so two real input blocks are transformed at once
+// as the real and imaginary parts of one complex block. After multiplying
+// by a filter's spectrum, the real part of the inverse is the first
+// block's output and the imaginary part is the second's. The forward
+// transform of each block pair is shared by every filter
+static int overlap_save(long length, double input_signal[],
+                        int order, int num_filters, double coeffs[],
+                        long start, long end,
+                        double output_signal[], double pow_sums[]) {
+
+  int taps  = order + 1;
+  int nfft  = next_power_of_two(4 * taps);
+  if (nfft < 256) {
+    nfft = 256;
+  }
+  int valid = nfft - order;  // outputs per block
+
+  fft_plan* plan  = fft_plan_create(nfft);
+  double* filt    = (double*)calloc(2 * nfft * (size_t)num_filters, sizeof(double));
+  double* spec    = (double*)malloc(sizeof(double) * 2 * nfft);
+  double* block   = (double*)malloc(sizeof(double) * 2 * nfft);
+  if (!plan || !filt || !spec || !block) {
+    fft_plan_destroy(plan);
+    free(filt);
+    free(spec);
+    free(block);
+    return -1;
+  }
+
+  // Filter spectra, scaled so the inverse transform needs no 1/n
+  for (int f = 0; f < num_filters; f++) {
+    double* ff = &filt[2 * nfft * (size_t)f];
+    for (int j = 0; j < taps; j++) {
+      ff[2 * j] = coeffs[(size_t)f * taps + j] / nfft;
+    }
+    fft_execute(plan, ff, 0);
+  }
+
+  for (long first = start; first < end; first += 2 * valid) {
+    // block b produces outputs first + b*valid ... + valid - 1
+    for (int k = 0; k < nfft; k++) {
+      long i1 = first - order + k;
+      long i2 = i1 + valid;
+      spec[2 * k]     = (i1 >= 0 && i1 < length) ? input_signal[i1] : 0;
+      spec[2 * k + 1] = (i2 >= 0 && i2 < length) ? input_signal[i2] : 0;
+    }
+    fft_execute(plan, spec, 0);
+
+    for (int f = 0; f < num_filters; f++) {
+      double* ff = &filt[2 * nfft * (size_t)f];
+      for (int k = 0; k < nfft; k++) {
+        double br = spec[2 * k];
+        double bi = spec[2 * k + 1];
+        double fr = ff[2 * k];
+        double fi = ff[2 * k + 1];
+        block[2 * k]     = br * fr - bi * fi;
+        block[2 * k + 1] = br * fi + bi * fr;
+      }
+      fft_execute(plan, block, 1);
+
+      double sum = 0;
+      for (int half = 0; half < 2; half++) {
+        long out = first + half * valid;
+        for (int k = 0; k < valid && out + k < end; k++) {
+          double y = block[2 * (order + k) + half];
+          if (output_signal) {
+            output_signal[out + k] = y;
+          }
+          sum += y * y;
+        }
+      }
+      if (pow_sums) {
+        pow_sums[f] += sum;
+      }
+    }
+  }
+
+  fft_plan_destroy(plan);
+  free(filt);
+  free(spec);
+  free(block);
+  return 0;
+}
+
+int convolve_fft(long length, double input_signal[],
+                 int order, double coeffs[],
+                 double output_signal[]) {
+  return overlap_save(length, input_signal, order, 1, coeffs, 0, length, output_signal, NULL);
+}
+
+int convolve_and_compute_power_fft(long length, double input_signal[],
+                                   int order, double coeffs[],
+                                   double* power) {
+  double pow_sum = 0;
+  if (overlap_save(length, input_signal, order, 1, coeffs, 0, length, NULL, &pow_sum)) {
+    return -1;
+  }
+  *power = pow_sum / length;
+  return 0;
+}
+
+
+/* Polyphase (uniform DFT) channelizer */
+
+// The band pass filters the scanners build are all the same low-pass
+// prototype h[] shifted up to each band's center:
+//   band_k[m] = 2 cos(w_k (m - order/2)) h[m],   w_k = 2 pi (k + 1/2) / M
+// with M = 2 * num_bands channels across 0..Fs. So each band's output is
+//   y_k[n] = 2 Re(e^(-i w_k order/2) z_k[n]),   z_k[n] = sum_m h[m] e^(i w_k m) x[n - m]
+// Splitting m = r + qM, the e^(i 2 pi k r / M) part is shared by every band:
+// fold h[m] e^(i pi m / M) x[n - m] into M bins, then one M point inverse
+// DFT gives z_k for all bands at once.
+//
+// This yields the same filter outputs the per-band loop computes, but only
+// every num_bands samples; the mean of their squares is the band power
+
+int channelize_power_sums(long length, double input_signal[],
+                          double Fs, int order, int num_bands,
+                          long start, long end,
+                          double pow_sums[], long* frames) {
+  assert(order > 0 && !(order & 0x1));
+  assert(num_bands > 0);
+
+  int M = 2 * num_bands;
+  int D = num_bands;
+  int taps = order + 1;
+
+  double h[taps];
+  generate_low_pass(Fs, Fs / (2 * M) - 0.0001, order, h);
+  hamming_window(order, h);
+
+  fft_plan* plan = fft_plan_create(M);
+  double* hm     = (double*)malloc(sizeof(double) * 2 * taps);
+  double* bins   = (double*)malloc(sizeof(double) * 2 * M);
+  if (!plan || !hm || !bins) {
+    fft_plan_destroy(plan);
+    free(hm);
+    free(bins);
+    return -1;
+  }
+
+  for (int m = 0; m < taps; m++) {
+    hm[2 * m]     = h[m] * cos(M_PI * m / M);
+    hm[2 * m + 1] = h[m] * sin(M_PI * m / M);
+  }
+
+  // e^(-i w_k order/2), lines z_k up with the symmetric band pass filter
+  double rot[2 * num_bands];
+  for (int k = 0; k < num_bands; k++) {
+    double w = 2 * M_PI * (k + 0.5) / M;
+    rot[2 * k]     = cos(w * (order / 2));
+    rot[2 * k + 1] = -sin(w * (order / 2));
+  }
+
+  // frames sit on multiples of D so split ranges line up with a whole-signal run
+  long first = ((start + D - 1) / D) * D;
+  long count = 0;
+  for (long n = first; n < end && n < length; n += D) {
+    for (int r = 0; r < 2 * M; r++) {
+      bins[r] = 0;
+    }
+
+    int r = 0;
+    for (int m = 0; m < taps && m <= n; m++) {
+      double x = input_signal[n - m];
+      bins[2 * r]     += hm[2 * m] * x;
+      bins[2 * r + 1] += hm[2 * m + 1] * x;
+      if (++r == M) {
+        r = 0;
+      }
+    }
+
+    fft_execute(plan, bins, 1);
+
+    for (int k = 0; k < num_bands; k++) {
+      double y = 2 * (bins[2 * k] * rot[2 * k] - bins[2 * k + 1] * rot[2 * k + 1]);
+      pow_sums[k] += y * y;
+    }
+    count++;
+  }
+
+  *frames += count;
+
+  fft_plan_destroy(plan);
+  free(hm);
+  free(bins);
+  return 0;
+}
+
+int channelize_and_compute_power(long length, double input_signal[],
+                                 double Fs, int order, int num_bands,
+                                 double power[]) {
+  long frames = 0;
+  for (int k = 0; k < num_bands; k++) {
+    power[k] = 0;
+  }
+
+  if (channelize_power_sums(length, input_signal, Fs, order, num_bands,
+                            0, length, power, &frames)) {
+    return -1;
+  }
+
+  for (int k = 0; k < num_bands; k++) {
+    power[k] = frames ? power[k] / frames : 0;
+  }
+  return 0;
+}
+
+
+/* Welch power spectral density */
+
+long welch_segments(long length, int seg_len) {
+  if (length <= 0) {
+    return 0;
+  }
+  if (length <= seg_len) {
+    return 1;
+  }
+  return (length - seg_len) / (seg_len / 2) + 1;
+}
+
+int welch_segment_length(int order, int num_bands) {
+  assert(order > 0 && num_bands > 0);
+  int n = next_power_of_two(order < 2 ? 2 : order);
+  while (n / 2 < WELCH_BINS_PER_BAND * num_bands) {
+    n <<= 1;
+  }
+  return n;
+}
+
+// Two segments go through each transform, as its real and imaginary
+// parts. Their spectra A and B are not needed separately: the sum of the
+// two periodograms at bin k is |A_k|^2 + |B_k|^2 = (|X_k|^2 + |X_(n-k)|^2) / 2
+int welch_psd_sums(long length, double input_signal[], int seg_len,
+                   long first, long end, double psd_sums[]) {
+  assert(seg_len >= 2 && !(seg_len & 0x1));
+
+  int hop = seg_len / 2;
+  fft_plan* plan = fft_plan_create(seg_len);
+  double* win = (double*)malloc(sizeof(double) * seg_len);
+  double* buf = (double*)malloc(sizeof(double) * 2 * seg_len);
+  if (!plan || !win || !buf) {
+    fft_plan_destroy(plan);
+    free(win);
+    free(buf);
+    return -1;
+  }
+
+  // Periodic Hann window; dividing by its power undoes what it takes out,
+  // so the two-sided bins |X_k|^2 / (seg_len u) add up to the mean power
+  double u = 0;
+  for (int k = 0; k < seg_len; k++) {
+    win[k] = 0.5 - 0.5 * cos(2 * M_PI * k / seg_len);
+    u += win[k] * win[k];
+  }
+  double scale = 1.0 / ((double)seg_len * u);
+
+  for (long s = first; s < end; s += 2) {
+    long a = s * hop;
+    long b = (s + 1 < end) ? (s + 1) * hop : length;
+    for (int k = 0; k < seg_len; k++) {
+      buf[2 * k]     = (a + k < length) ? input_signal[a + k] * win[k] : 0;
+      buf[2 * k + 1] = (b + k < length) ? input_signal[b + k] * win[k] : 0;
+    }
+    fft_execute(plan, buf, 0);
+
+    // folded onto one side: every bin but DC and Nyquist counts twice
+    for (int j = 0; j <= hop; j++) {
+      int m = (seg_len - j) % seg_len;
+      double p = (buf[2 * j] * buf[2 * j] + buf[2 * j + 1] * buf[2 * j + 1] +
+                  buf[2 * m] * buf[2 * m] + buf[2 * m + 1] * buf[2 * m + 1]) / 2;
+      psd_sums[j] += ((j == 0 || j == hop) ? 1 : 2) * scale * p;
+    }
+  }
+
+  fft_plan_destroy(plan);
+  free(win);
+  free(buf);
+  return 0;
+}
+
+int welch_psd(long length, double input_signal[], int seg_len, double psd[]) {
+  long segments = welch_segments(length, seg_len);
+  for (int j = 0; j <= seg_len / 2; j++) {
+    psd[j] = 0;
+  }
+
+  if (welch_psd_sums(length, input_signal, seg_len, 0, segments, psd)) {
+    return -1;
+  }
+
+  for (int j = 0; j <= seg_len / 2; j++) {
+    psd[j] = segments ? psd[j] / segments : 0;
+  }
+  return 0;
+}
+
+// Bin j stands for frequencies (j - 1/2 .. j + 1/2) Fs / seg_len, clipped
+// to 0..Fs/2 at the ends
+void welch_band_power(int seg_len, double psd[], double Fs,
+                      int num_bands, double Fcl[], double Fch[], double power[]) {
+  int hop = seg_len / 2;
+  double df = Fs / seg_len;
+
+  for (int b = 0; b < num_bands; b++) {
+    double lo = Fcl[b] / df;
+    double hi = Fch[b] / df;
+    int j0 = (int)floor(lo + 0.5);
+    int j1 = (int)floor(hi + 0.5);
+    if (j0 < 0) {
+      j0 = 0;
+    }
+    if (j1 > hop) {
+      j1 = hop;
+    }
+
+    double sum = 0;
+    for (int j = j0; j <= j1; j++) {
+      double bin_lo = (j == 0) ? 0 : j - 0.5;
+      double bin_hi = (j == hop) ? hop : j + 0.5;
+      double in = fmin(bin_hi, hi) - fmax(bin_lo, lo);
+      if (in > 0) {
+        sum += psd[j] * in / (bin_hi - bin_lo);
+      }
+    }
+    power[b] = sum;
+  }
+}
+
+
+/* Goertzel detector bank and sliding DFT */
+
+// Each frequency's filter is s[n] = x[n] + c s[n-1] - s[n-2], c = 2 cos(w),
+// and after the last sample |X(w)|^2 = s1^2 + s2^2 - c s1 s2. Every step
+// depends on the one before, so the kernels run GOERTZEL_LANES frequencies
+// side by side to keep that many chains in flight, sharing each sample.
+// Samples go through in tiles of GOERTZEL_TILE that stay in L1 while
+// every group of lanes runs over them.
+#define GOERTZEL_LANES 32
+#define GOERTZEL_TILE  4096
+
+typedef void (*goertzel_lanes_fn)(double input_signal[], long start, long end,
+                                  double c[], double s1[], double s2[]);
+
+static void goertzel_lanes_scalar(double input_signal[], long start, long end,
+                                  double c[], double s1[], double s2[]) {
+  for (long i = start; i < end; i++) {
+    double x = input_signal[i];
+    for (int f = 0; f < GOERTZEL_LANES; f++) {
+      double s = x + c[f] * s1[f] - s2[f];
+      s2[f] = s1[f];
+      s1[f] = s;
+    }
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// Eight vectors of four lanes
+__attribute__((target("avx2,fma")))
+static void goertzel_lanes_avx2(double input_signal[], long start, long end,
+                                double c[], double s1[], double s2[]) {
+  __m256d cv[8];
+  __m256d a[8];
+  __m256d b[8];
+  for (int v = 0; v < 8; v++) {
+    cv[v] = _mm256_loadu_pd(&c[4 * v]);
+    a[v]  = _mm256_loadu_pd(&s1[4 * v]);
+    b[v]  = _mm256_loadu_pd(&s2[4 * v]);
+  }
+  for (long i = start; i < end; i++) {
+    __m256d x = _mm256_broadcast_sd(&input_signal[i]);
+    for (int v = 0; v < 8; v++) {
+      __m256d s = _mm256_fmadd_pd(cv[v], a[v], _mm256_sub_pd(x, b[v]));
+      b[v] = a[v];
+      a[v] = s;
+    }
+  }
+  for (int v = 0; v < 8; v++) {
+    _mm256_storeu_pd(&s1[4 * v], a[v]);
+    _mm256_storeu_pd(&s2[4 * v], b[v]);
+  }
+}
+
+// Four vectors of eight lanes
+__attribute__((target("avx512f")))
+static void goertzel_lanes_avx512(double input_signal[], long start, long end,
+                                  double c[], double s1[], double s2[]) {
+  __m512d cv[4];
+  __m512d a[4];
+  __m512d b[4];
+  for (int v = 0; v < 4; v++) {
+    cv[v] = _mm512_loadu_pd(&c[8 * v]);
+    a[v]  = _mm512_loadu_pd(&s1[8 * v]);
+    b[v]  = _mm512_loadu_pd(&s2[8 * v]);
+  }
+  for (long i = start; i < end; i++) {
+    __m512d x = _mm512_set1_pd(input_signal[i]);
+    for (int v = 0; v < 4; v++) {
+      __m512d s = _mm512_fmadd_pd(cv[v], a[v], _mm512_sub_pd(x, b[v]));
+      b[v] = a[v];
+      a[v] = s;
+    }
+  }
+  for (int v = 0; v < 4; v++) {
+    _mm512_storeu_pd(&s1[8 * v], a[v]);
+    _mm512_storeu_pd(&s2[8 * v], b[v]);
+  }
+}
+
+#endif
+
+static pthread_once_t goertzel_lanes_once = PTHREAD_ONCE_INIT;
+static goertzel_lanes_fn goertzel_lanes_kernel;
+
+static void choose_goertzel_lanes(void) {
+  goertzel_lanes_kernel = goertzel_lanes_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    goertzel_lanes_kernel = goertzel_lanes_avx512;
+  } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    goertzel_lanes_kernel = goertzel_lanes_avx2;
+  }
+#endif
+}
+
+static goertzel_lanes_fn goertzel_lanes(void) {
+  pthread_once(&goertzel_lanes_once, choose_goertzel_lanes);
+  return goertzel_lanes_kernel;
+}
+
+int goertzel_bank(long length, double input_signal[], double Fs,
+                  int num_freqs, double freqs[], double power[]) {
+  assert(num_freqs >= 0);
+
+  // padded to whole groups of lanes; the spare lanes just run c = 0
+  int groups = (num_freqs + GOERTZEL_LANES - 1) / GOERTZEL_LANES;
+  size_t lanes = (size_t)groups * GOERTZEL_LANES;
+  double* c  = (double*)calloc(lanes, sizeof(double));
+  double* s1 = (double*)calloc(lanes, sizeof(double));
+  double* s2 = (double*)calloc(lanes, sizeof(double));
+  if (!c || !s1 || !s2) {
+    free(c);
+    free(s1);
+    free(s2);
+    return -1;
+  }
+  for (int f = 0; f < num_freqs; f++) {
+    c[f] = 2 * cos(2 * M_PI * freqs[f] / Fs);
+  }
+
+  goertzel_lanes_fn body = goertzel_lanes();
+  for (long start = 0; start < length; start += GOERTZEL_TILE) {
+    long end = (length - start < GOERTZEL_TILE) ? length : start + GOERTZEL_TILE;
+    for (int g = 0; g < groups; g++) {
+      size_t k = (size_t)g * GOERTZEL_LANES;
+      body(input_signal, start, end, &c[k], &s1[k], &s2[k]);
+    }
+  }
+
+  double scale = length > 0 ? 2.0 / ((double)length * length) : 0;
+  for (int f = 0; f < num_freqs; f++) {
+    power[f] = scale * (s1[f] * s1[f] + s2[f] * s2[f] - c[f] * s1[f] * s2[f]);
+  }
+
+  free(c);
+  free(s1);
+  free(s2);
+  return 0;
+}
+
+long sliding_dft_windows(long length, int window, int hop) {
+  if (window <= 0 || hop <= 0 || length < window) {
+    return 0;
+  }
+  return (length - window) / hop + 1;
+}
+
+// Each frequency keeps X_n = e^(iw) X_(n-1) + x[n] - e^(iwW) x[n-W], the
+// DFT of the last W = window samples up to a phase, for one complex
+// multiply and a little more per update. Like the Goertzel bank, the
+// kernels update SDFT_LANES frequencies side by side, kept in registers
+// between the windows' outputs, over tiles of samples.
+#define SDFT_LANES 32
+
+// c[] holds the lanes' e^(iw) real parts, then imaginary parts, then the
+// same for e^(iwW)
+typedef void (*sdft_lanes_fn)(double input_signal[], long start, long end, int window,
+                              double c[], double yr[], double yi[]);
+
+static void sdft_lanes_scalar(double input_signal[], long start, long end, int window,
+                              double c[], double yr[], double yi[]) {
+  double* ar = c;
+  double* ai = c + SDFT_LANES;
+  double* dr = c + 2 * SDFT_LANES;
+  double* di = c + 3 * SDFT_LANES;
+  for (long n = start; n < end; n++) {
+    double in  = input_signal[n];
+    double old = n >= window ? input_signal[n - window] : 0;
+    for (int f = 0; f < SDFT_LANES; f++) {
+      double r = ar[f] * yr[f] - ai[f] * yi[f] + in - dr[f] * old;
+      double i = ar[f] * yi[f] + ai[f] * yr[f] - di[f] * old;
+      yr[f] = r;
+      yi[f] = i;
+    }
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// Eight vectors of four lanes; the constants come from L1
+__attribute__((target("avx2,fma")))
+static void sdft_lanes_avx2(double input_signal[], long start, long end, int window,
+                            double c[], double yr[], double yi[]) {
+  __m256d r[8];
+  __m256d i[8];
+  for (int v = 0; v < 8; v++) {
+    r[v] = _mm256_loadu_pd(&yr[4 * v]);
+    i[v] = _mm256_loadu_pd(&yi[4 * v]);
+  }
+  for (long n = start; n < end; n++) {
+    __m256d in  = _mm256_broadcast_sd(&input_signal[n]);
+    __m256d old = _mm256_set1_pd(n >= window ? input_signal[n - window] : 0);
+    for (int v = 0; v < 8; v++) {
+      __m256d ar = _mm256_loadu_pd(&c[4 * v]);
+      __m256d ai = _mm256_loadu_pd(&c[SDFT_LANES + 4 * v]);
+      __m256d dr = _mm256_loadu_pd(&c[2 * SDFT_LANES + 4 * v]);
+      __m256d di = _mm256_loadu_pd(&c[3 * SDFT_LANES + 4 * v]);
+      __m256d nr = _mm256_fmadd_pd(ar, r[v], _mm256_fnmadd_pd(ai, i[v], _mm256_fnmadd_pd(dr, old, in)));
+      __m256d ni = _mm256_fmadd_pd(ar, i[v], _mm256_fmsub_pd(ai, r[v], _mm256_mul_pd(di, old)));
+      r[v] = nr;
+      i[v] = ni;
+    }
+  }
+  for (int v = 0; v < 8; v++) {
+    _mm256_storeu_pd(&yr[4 * v], r[v]);
+    _mm256_storeu_pd(&yi[4 * v], i[v]);
+  }
+}
+
+// Four vectors of eight lanes, constants and state all in registers
+__attribute__((target("avx512f")))
+static void sdft_lanes_avx512(double input_signal[], long start, long end, int window,
+                              double c[], double yr[], double yi[]) {
+  __m512d ar[4], ai[4], dr[4], di[4];
+  __m512d r[4];
+  __m512d i[4];
+  for (int v = 0; v < 4; v++) {
+    ar[v] = _mm512_loadu_pd(&c[8 * v]);
+    ai[v] = _mm512_loadu_pd(&c[SDFT_LANES + 8 * v]);
+    dr[v] = _mm512_loadu_pd(&c[2 * SDFT_LANES + 8 * v]);
+    di[v] = _mm512_loadu_pd(&c[3 * SDFT_LANES + 8 * v]);
+    r[v]  = _mm512_loadu_pd(&yr[8 * v]);
+    i[v]  = _mm512_loadu_pd(&yi[8 * v]);
+  }
+  for (long n = start; n < end; n++) {
+    __m512d in  = _mm512_set1_pd(input_signal[n]);
+    __m512d old = _mm512_set1_pd(n >= window ? input_signal[n - window] : 0);
+    for (int v = 0; v < 4; v++) {
+      __m512d nr = _mm512_fmadd_pd(ar[v], r[v], _mm512_fnmadd_pd(ai[v], i[v], _mm512_fnmadd_pd(dr[v], old, in)));
+      __m512d ni = _mm512_fmadd_pd(ar[v], i[v], _mm512_fmsub_pd(ai[v], r[v], _mm512_mul_pd(di[v], old)));
+      r[v] = nr;
+      i[v] = ni;
+    }
+  }
+  for (int v = 0; v < 4; v++) {
+    _mm512_storeu_pd(&yr[8 * v], r[v]);
+    _mm512_storeu_pd(&yi[8 * v], i[v]);
+  }
+}
+
+#endif
+
+static pthread_once_t sdft_lanes_once = PTHREAD_ONCE_INIT;
+static sdft_lanes_fn sdft_lanes_kernel;
+
+static void choose_sdft_lanes(void) {
+  sdft_lanes_kernel = sdft_lanes_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    sdft_lanes_kernel = sdft_lanes_avx512;
+  } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    sdft_lanes_kernel = sdft_lanes_avx2;
+  }
+#endif
+}
+
+static sdft_lanes_fn sdft_lanes(void) {
+  pthread_once(&sdft_lanes_once, choose_sdft_lanes);
+  return sdft_lanes_kernel;
+}
+
+int sliding_dft_power(long length, double input_signal[], double Fs,
+                      int num_freqs, double freqs[], int window, int hop,
+                      double power[]) {
+  assert(window > 0 && hop > 0 && num_freqs >= 0);
+
+  // padded to whole groups of lanes; the spare lanes just run w = 0
+  long windows = sliding_dft_windows(length, window, hop);
+  int groups = (num_freqs + SDFT_LANES - 1) / SDFT_LANES;
+  size_t lanes = (size_t)groups * SDFT_LANES;
+  double* c  = (double*)calloc(4 * lanes, sizeof(double));
+  double* yr = (double*)calloc(lanes, sizeof(double));
+  double* yi = (double*)calloc(lanes, sizeof(double));
+  if (!c || !yr || !yi) {
+    free(c);
+    free(yr);
+    free(yi);
+    return -1;
+  }
+  for (size_t f = 0; f < lanes; f++) {
+    double w = f < (size_t)num_freqs ? 2 * M_PI * freqs[f] / Fs : 0;
+    double* cg = &c[4 * (f - f % SDFT_LANES)] + f % SDFT_LANES;
+    cg[0]              = cos(w);
+    cg[SDFT_LANES]     = sin(w);
+    cg[2 * SDFT_LANES] = cos(w * window);
+    cg[3 * SDFT_LANES] = sin(w * window);
+  }
+
+  sdft_lanes_fn body = sdft_lanes();
+  double scale = 2.0 / ((double)window * window);
+  long last = windows > 0 ? window - 1 + (windows - 1) * hop : -1;
+  for (long start = 0; start <= last; start += GOERTZEL_TILE) {
+    long end = (last + 1 - start < GOERTZEL_TILE) ? last + 1 : start + GOERTZEL_TILE;
+
+    // first window that ends in this tile
+    long first_out = window - 1;
+    if (start > first_out) {
+      first_out += (start - first_out + hop - 1) / hop * hop;
+    }
+
+    for (int g = 0; g < groups; g++) {
+      size_t k = (size_t)g * SDFT_LANES;
+      int count = (num_freqs - (int)k < SDFT_LANES) ? num_freqs - (int)k : SDFT_LANES;
+
+      // run up to and including each window's last sample, then read it out
+      long n = start;
+      for (long out = first_out; out < end; out += hop) {
+        body(input_signal, n, out + 1, window, &c[4 * k], &yr[k], &yi[k]);
+        n = out + 1;
+        double* p = &power[((out - (window - 1)) / hop) * num_freqs + k];
+        for (int f = 0; f < count; f++) {
+          p[f] = scale * (yr[k + f] * yr[k + f] + yi[k + f] * yi[k + f]);
+        }
+      }
+      body(input_signal, n, end, window, &c[4 * k], &yr[k], &yi[k]);
+    }
+  }
+
+  free(c);
+  free(yr);
+  free(yi);
+  return 0;
+}
+
+/* Digital down-conversion */
+
+// Half-band stages: a Hamming windowed sinc cutting off at a quarter of
+// the stage's input rate. Every other tap but the center is zero, so a
+// stage does DDC_HALFBAND_ORDER / 4 + 1 multiplies per complex component
+// and output. Passband to 0.2 and stopband from 0.3 of the input rate,
+// which is what DDC_BAND_FRACTION leaves room for.
+#define DDC_HALFBAND_ORDER 30
+
+// Full rate samples mixed and decimated at a time
+#define DDC_BLOCK 4096
+
+int ddc_decimation(double Fs, double Fcl, double Fch) {
+  double bandwidth = Fch - Fcl;
+  int decimation = 1;
+  while (decimation < DDC_MAX_DECIMATION &&
+         2 * decimation * bandwidth <= DDC_BAND_FRACTION * Fs) {
+    decimation *= 2;
+  }
+  return decimation;
+}
+
+int ddc_order(int order, int decimation) {
+  int reduced = (order / decimation) & ~0x1;
+  return reduced < DDC_MIN_ORDER ? DDC_MIN_ORDER : reduced;
+}
+
+// A complex FIR over a stream that arrives a block at a time. The first
+// order entries of re[] and im[] carry the history of earlier blocks, and
+// the block goes after them
+typedef struct ddc_stage_ {
+  double* re;
+  double* im;
+  long count;   // inputs so far, for the decimation phase
+} ddc_stage;
+
+// Keeps the last order inputs as the next block's history
+static void ddc_stage_shift(ddc_stage* st, int order, int n) {
+  memmove(st->re, st->re + n, sizeof(double) * order);
+  memmove(st->im, st->im + n, sizeof(double) * order);
+  st->count += n;
+}
+
+// One component of a run of half-band outputs from the input's two
+// phases: the center tap sees even[], the others odd[] (which may be read
+// up to (DDC_HALFBAND_ORDER + 2) / 4 entries before its start)
+//   out[j] = h[c] even[j] + sum over odd k <= c of h[c - k] (odd[j + (k - 1) / 2] + odd[j - (k + 1) / 2])
+typedef void (*ddc_halfband_fn)(double even[], double odd[], int made, double h[],
+                                double out[]);
+
+static void ddc_halfband_scalar(double even[], double odd[], int made, double h[],
+                                double out[]) {
+  int c = DDC_HALFBAND_ORDER / 2;
+  for (int j = 0; j < made; j++) {
+    double y = h[c] * even[j];
+    for (int k = 1; k <= c; k += 2) {
+      y += h[c - k] * (odd[j + (k - 1) / 2] + odd[j - (k + 1) / 2]);
+    }
+    out[j] = y;
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// 16 outputs per pass, four vectors of four
+__attribute__((target("avx2,fma")))
+static void ddc_halfband_avx2(double even[], double odd[], int made, double h[],
+                              double out[]) {
+  int c = DDC_HALFBAND_ORDER / 2;
+  __m256d hc = _mm256_set1_pd(h[c]);
+  int j = 0;
+  for (; j + 16 <= made; j += 16) {
+    __m256d y0 = _mm256_mul_pd(hc, _mm256_loadu_pd(&even[j]));
+    __m256d y1 = _mm256_mul_pd(hc, _mm256_loadu_pd(&even[j + 4]));
+    __m256d y2 = _mm256_mul_pd(hc, _mm256_loadu_pd(&even[j + 8]));
+    __m256d y3 = _mm256_mul_pd(hc, _mm256_loadu_pd(&even[j + 12]));
+    for (int k = 1; k <= c; k += 2) {
+      __m256d hk = _mm256_set1_pd(h[c - k]);
+      double* a = &odd[j + (k - 1) / 2];
+      double* b = &odd[j - (k + 1) / 2];
+      y0 = _mm256_fmadd_pd(hk, _mm256_add_pd(_mm256_loadu_pd(a), _mm256_loadu_pd(b)), y0);
+      y1 = _mm256_fmadd_pd(hk, _mm256_add_pd(_mm256_loadu_pd(a + 4), _mm256_loadu_pd(b + 4)), y1);
+      y2 = _mm256_fmadd_pd(hk, _mm256_add_pd(_mm256_loadu_pd(a + 8), _mm256_loadu_pd(b + 8)), y2);
+      y3 = _mm256_fmadd_pd(hk, _mm256_add_pd(_mm256_loadu_pd(a + 12), _mm256_loadu_pd(b + 12)), y3);
+    }
+    _mm256_storeu_pd(&out[j], y0);
+    _mm256_storeu_pd(&out[j + 4], y1);
+    _mm256_storeu_pd(&out[j + 8], y2);
+    _mm256_storeu_pd(&out[j + 12], y3);
+  }
+  ddc_halfband_scalar(even + j, odd + j, made - j, h, out + j);
+}
+
+// Same blocking with eight doubles per vector
+__attribute__((target("avx512f")))
+static void ddc_halfband_avx512(double even[], double odd[], int made, double h[],
+                                double out[]) {
+  int c = DDC_HALFBAND_ORDER / 2;
+  __m512d hc = _mm512_set1_pd(h[c]);
+  int j = 0;
+  for (; j + 32 <= made; j += 32) {
+    __m512d y0 = _mm512_mul_pd(hc, _mm512_loadu_pd(&even[j]));
+    __m512d y1 = _mm512_mul_pd(hc, _mm512_loadu_pd(&even[j + 8]));
+    __m512d y2 = _mm512_mul_pd(hc, _mm512_loadu_pd(&even[j + 16]));
+    __m512d y3 = _mm512_mul_pd(hc, _mm512_loadu_pd(&even[j + 24]));
+    for (int k = 1; k <= c; k += 2) {
+      __m512d hk = _mm512_set1_pd(h[c - k]);
+      double* a = &odd[j + (k - 1) / 2];
+      double* b = &odd[j - (k + 1) / 2];
+      y0 = _mm512_fmadd_pd(hk, _mm512_add_pd(_mm512_loadu_pd(a), _mm512_loadu_pd(b)), y0);
+      y1 = _mm512_fmadd_pd(hk, _mm512_add_pd(_mm512_loadu_pd(a + 8), _mm512_loadu_pd(b + 8)), y1);
+      y2 = _mm512_fmadd_pd(hk, _mm512_add_pd(_mm512_loadu_pd(a + 16), _mm512_loadu_pd(b + 16)), y2);
+      y3 = _mm512_fmadd_pd(hk, _mm512_add_pd(_mm512_loadu_pd(a + 24), _mm512_loadu_pd(b + 24)), y3);
+    }
+    _mm512_storeu_pd(&out[j], y0);
+    _mm512_storeu_pd(&out[j + 8], y1);
+    _mm512_storeu_pd(&out[j + 16], y2);
+    _mm512_storeu_pd(&out[j + 24], y3);
+  }
+  ddc_halfband_scalar(even + j, odd + j, made - j, h, out + j);
+}
+
+#endif
+
+static pthread_once_t ddc_halfband_body_once = PTHREAD_ONCE_INIT;
+static ddc_halfband_fn ddc_halfband_body_kernel;
+
+static void choose_ddc_halfband_body(void) {
+  ddc_halfband_body_kernel = ddc_halfband_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    ddc_halfband_body_kernel = ddc_halfband_avx512;
+  } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    ddc_halfband_body_kernel = ddc_halfband_avx2;
+  }
+#endif
+}
+
+static ddc_halfband_fn ddc_halfband_body(void) {
+  pthread_once(&ddc_halfband_body_once, choose_ddc_halfband_body);
+  return ddc_halfband_body_kernel;
+}
+
+// Half-band filters the n new inputs and writes every other output, the
+// ones at even input positions, to out_re[] and out_im[]. Returns how
+// many it wrote. The taps other than the center are all an odd distance
+// from it, so splitting the input into its two phases first lets the
+// kernels read both with unit stride
+static int ddc_halfband(ddc_stage* st, int n, double h[], double out_re[], double out_im[]) {
+  int c    = DDC_HALFBAND_ORDER / 2;  // odd
+  int half = (c + 1) / 2;
+  int t0   = (int)(st->count & 0x1);
+  int made = (n - t0 + 1) / 2;
+  double* xr = &st->re[DDC_HALFBAND_ORDER + t0 - c];  // center of output 0
+  double* xi = &st->im[DDC_HALFBAND_ORDER + t0 - c];
+
+  // even[m] = x[2m], odd[m + half] = x[2m + 1]
+  double even_re[made];
+  double even_im[made];
+  double odd_re[made + 2 * half];
+  double odd_im[made + 2 * half];
+  for (int m = 0; m < made; m++) {
+    even_re[m] = xr[2 * m];
+    even_im[m] = xi[2 * m];
+  }
+  for (int m = -half; m < made + half - 1; m++) {
+    odd_re[m + half] = xr[2 * m + 1];
+    odd_im[m + half] = xi[2 * m + 1];
+  }
+
+  ddc_halfband_fn body = ddc_halfband_body();
+  body(even_re, &odd_re[half], made, h, out_re);
+  body(even_im, &odd_im[half], made, h, out_im);
+
+  ddc_stage_shift(st, DDC_HALFBAND_ORDER, n);
+  return made;
+}
+
+int ddc_band_power(long length, double input_signal[], double Fs,
+                   double Fcl, double Fch, int order, int decimation,
+                   double* power) {
+  assert(order > 0 && !(order & 0x1));
+  assert(decimation > 0 && !(decimation & (decimation - 1)));
+  assert(Fch > Fcl && (Fch - Fcl) / 2 < Fs / (2 * decimation));
+
+  int stages = 0;
+  while ((1 << stages) < decimation) {
+    stages++;
+  }
+
+  double halfband[DDC_HALFBAND_ORDER + 1];
+  double lowpass[order + 1];
+  generate_low_pass(4, 1, DDC_HALFBAND_ORDER, halfband);
+  hamming_window(DDC_HALFBAND_ORDER, halfband);
+  generate_low_pass(Fs / decimation, (Fch - Fcl) / 2, order, lowpass);
+  hamming_window(order, lowpass);
+
+  // stage i decimates into stage i + 1; the last one is the low-pass
+  ddc_stage st[stages + 1];
+  int ok = 1;
+  for (int i = 0; i <= stages; i++) {
+    int hist = i < stages ? DDC_HALFBAND_ORDER : order;
+    st[i].re    = (double*)calloc(hist + DDC_BLOCK, sizeof(double));
+    st[i].im    = (double*)calloc(hist + DDC_BLOCK, sizeof(double));
+    st[i].count = 0;
+    ok = ok && st[i].re && st[i].im;
+  }
+
+  // e^(-iwt) for t within a block; each block turns it by its start
+  double w = 2 * M_PI * ((Fcl + Fch) / 2) / Fs;
+  double* turn_r = (double*)malloc(sizeof(double) * DDC_BLOCK);
+  double* turn_i = (double*)malloc(sizeof(double) * DDC_BLOCK);
+  ok = ok && turn_r && turn_i;
+  for (int t = 0; ok && t < DDC_BLOCK; t++) {
+    turn_r[t] = cos(w * t);
+    turn_i[t] = -sin(w * t);
+  }
+
+  // the low-pass only feeds the power, which the FIR kernels sum directly
+  double taps[order + 1];
+  fir_power_body_fn body = fir_power_prepare(order, lowpass, taps);
+
+  double pow_sum = 0;
+  long outputs = 0;
+  for (long first = 0; ok && first < length; first += DDC_BLOCK) {
+    int n = (length - first < DDC_BLOCK) ? length - first : DDC_BLOCK;
+
+    // mix down by e^(-iwn)
+    int hist = stages > 0 ? DDC_HALFBAND_ORDER : order;
+    double* mr = &st[0].re[hist];
+    double* mi = &st[0].im[hist];
+    double br = cos(fmod(w * first, 2 * M_PI));
+    double bi = -sin(fmod(w * first, 2 * M_PI));
+    for (int t = 0; t < n; t++) {
+      double x = input_signal[first + t];
+      mr[t] = x * (br * turn_r[t] - bi * turn_i[t]);
+      mi[t] = x * (br * turn_i[t] + bi * turn_r[t]);
+    }
+
+    for (int i = 0; i < stages; i++) {
+      int next_hist = i + 1 < stages ? DDC_HALFBAND_ORDER : order;
+      n = ddc_halfband(&st[i], n, halfband, &st[i + 1].re[next_hist], &st[i + 1].im[next_hist]);
+    }
+
+    // low-pass at the reduced rate, and the power of what comes out
+    ddc_stage* lp = &st[stages];
+    pow_sum += body(lp->re, order, taps, order, order + n) +
+               body(lp->im, order, taps, order, order + n);
+    ddc_stage_shift(lp, order, n);
+    outputs += n;
+  }
+
+  for (int i = 0; i <= stages; i++) {
+    free(st[i].re);
+    free(st[i].im);
+  }
+  free(turn_r);
+  free(turn_i);
+  if (!ok) {
+    return -1;
+  }
+
+  // the band's negative frequencies were filtered out with the rest, and
+  // they carry as much power as the positive ones
+  *power = outputs ? 2 * pow_sum / outputs : 0;
+  return 0;
+}
+
+
 /* below taken from http://www.exstrom.com/journal/sigproc/liir.c */
 
 /**********************************************************************
@@ -337,7 +2815,7 @@ void butter(int n, double fcf, double** b, double** a) {
  * y = filter(b, a, x)
  */
 void filter(int ord, double* a, double* b,
-            int np, double* x, double* y) {
+            long np, double* x, double* y) {
 
   y[0] = b[0] * x[0];
 
@@ -355,7 +2833,7 @@ void filter(int ord, double* a, double* b,
   }
 
   /* end of initial part */
-  for (int i = ord + 1; i < np + 1; i++) {
+  for (long i = ord + 1; i < np + 1; i++) {
 
     y[i] = 0.0;
 
@@ -371,23 +2849,23 @@ void filter(int ord, double* a, double* b,
 
 /* y = filtfilt(b, a, x) */
 void filtfilt(int ord, double* a, double* b,
-              int np, double* x, double* y) {
+              long np, double* x, double* y) {
 
   filter(ord, a, b, np, x, y);
 
   /* reverse the series */
-  for (int i = 0; i < np; i++) {
+  for (long i = 0; i < np; i++) {
     x[i] = y[np - i - 1];
   }
 
   filter(ord, a, b, np, x, y);
 
   /* put it back */
-  for (int i = 0; i < np; i++) {
+  for (long i = 0; i < np; i++) {
     x[i] = y[np - i - 1];
   }
 
-  for (int i = 0; i < np; i++) {
+  for (long i = 0; i < np; i++) {
     y[i] = x[i];
   }
 }
@@ -1,6 +1,8 @@
 #ifndef _filter
 #define _filter
 
+#include <stdint.h>
+
 /*
  *
  *  Basic 1D FIR filter generation by windowing,
@@ -18,7 +20,7 @@
  *
  *  double Fs, Fc;
  *  int order;
- *  int N;
+ *  long N;
  *  double coeffs[order+1];
  *  double input_signal[N];
  *  double output_signal[N];
@@ -52,28 +54,239 @@ int generate_band_stop(double Fs, double Fcl, double Fch,
 // coeffs[] array is overwritten. must have order+1 doubles
 int hamming_window(int order, double coeffs[]);
 
+// Band pass filter banks
+// Designs num_filters band pass filters in one go, filter f passing
+// Fcl[f] to Fch[f] with window applied, the same (to rounding) as
+// generate_band_pass() and then hamming_window() on each. The window is
+// computed once for every filter and the sines by an inline polynomial,
+// so the design loops vectorize instead of calling sin() per tap.
+#define FILTER_WINDOW_NONE    0
+#define FILTER_WINDOW_HAMMING 1
+
+int generate_band_pass_bank(double Fs, int order, int num_filters,
+                            double Fcl[], double Fch[], int window,
+                            double coeffs[][order + 1]);
+
+// The same through an in-memory cache keyed by (Fs, Fcl, Fch, order,
+// window), so repeated scans only copy their filters. Missing filters are
+// designed together and added. Safe to call from several threads.
+int cached_band_pass_bank(double Fs, int order, int num_filters,
+                          double Fcl[], double Fch[], int window,
+                          double coeffs[][order + 1]);
+
+// Keeping the cache between runs: save writes every cached filter to
+// file, load adds the filters in file. Both return 0 on success, -1 on
+// failure (load also fails if there is no file yet).
+int  filter_cache_save(const char* file);
+int  filter_cache_load(const char* file);
+void filter_cache_clear(void);
+
 // Simple (slow) convolution
 // output must be same length as input.
-int convolve(int length, double input_signal[],
+int convolve(long length, double input_signal[],
              int order, double coeffs[],
              double output_signal[]);
 
 // Simple (slow) convolution combined with power estimate for output
-int convolve_and_compute_power(int length, double input_signal[],
+// Symmetric (linear phase) coeffs are detected and need about half the multiplies
+int convolve_and_compute_power(long length, double input_signal[],
                                int order, double coeffs[],
                                double* power);
 
+// convolve_and_compute_power() for a bank of num_filters filters at once
+// coeffs[f] is filter f (order + 1 taps), power[f] gets its output power
+// Each tile of the signal is loaded once and every filter is applied to it
+// before moving on, instead of streaming the whole signal once per filter
+int convolve_bank_and_compute_power(long length, double input_signal[],
+                                    int order, int num_filters,
+                                    double coeffs[][order + 1],
+                                    double power[]);
+
+// Piece of the above for splitting one bank run into tasks
+// Adds each filter's sum of squared outputs for start <= i < end to
+// pow_sums[f]; power[f] is pow_sums[f] / length once every piece is in.
+// Outputs near start still see the order inputs before it.
+int convolve_bank_power_sums(long length, double input_signal[],
+                             int order, int num_filters,
+                             double coeffs[][order + 1],
+                             long start, long end, double pow_sums[]);
+
+// The same for signals kept as float or as int16_t, with two or four times
+// the samples per vector and a half or a quarter of the memory traffic.
+// Filters are still given as doubles. Outputs are summed in float, or in
+// 32-bit integers of 16-bit taps, and squared in double, so powers agree
+// with the double versions to about float (f32) or 14-bit tap (i16)
+// precision. An i16 sample i has the value scale * input_signal[i] - offset.
+int convolve_and_compute_power_f32(long length, float input_signal[],
+                                   int order, double coeffs[],
+                                   double* power);
+int convolve_and_compute_power_i16(long length, int16_t input_signal[],
+                                   double scale, double offset,
+                                   int order, double coeffs[],
+                                   double* power);
+int convolve_bank_and_compute_power_f32(long length, float input_signal[],
+                                        int order, int num_filters,
+                                        double coeffs[][order + 1],
+                                        double power[]);
+int convolve_bank_and_compute_power_i16(long length, int16_t input_signal[],
+                                        double scale, double offset,
+                                        int order, int num_filters,
+                                        double coeffs[][order + 1],
+                                        double power[]);
+int convolve_bank_power_sums_f32(long length, float input_signal[],
+                                 int order, int num_filters,
+                                 double coeffs[][order + 1],
+                                 long start, long end, double pow_sums[]);
+int convolve_bank_power_sums_i16(long length, int16_t input_signal[],
+                                 double scale, double offset,
+                                 int order, int num_filters,
+                                 double coeffs[][order + 1],
+                                 long start, long end, double pow_sums[]);
+
+// A filter bank fed the signal a block at a time, for signals that don't
+// fit in memory. Only the last order samples are kept between blocks.
+// fir_stream_power() gives what convolve_bank_and_compute_power() gives
+// for the whole signal, after removing its mean if remove_dc (the mean
+// is only known at the end, so it is corrected for there, exactly).
+typedef struct fir_stream_ fir_stream;
+
+fir_stream* fir_stream_create(int order, int num_filters, double coeffs[][order + 1]);
+void        fir_stream_destroy(fir_stream* stream);
+int         fir_stream_push(fir_stream* stream, long count, double samples[]);
+int         fir_stream_power(fir_stream* stream, int remove_dc, double power[]);
+long        fir_stream_samples(fir_stream* stream);
+double      fir_stream_mean(fir_stream* stream);
+double      fir_stream_signal_power(fir_stream* stream, int remove_dc);
+
+// All of the above switch to FFT (overlap-save) convolution once
+// order reaches this value, which is where it measured faster than
+// the vectorized direct loop
+#define FFT_CROSSOVER_ORDER 384
+
+// FFT (overlap-save) convolution, O(N log order) instead of O(N order)
+// Same results as convolve() and convolve_and_compute_power() up to rounding
+int convolve_fft(long length, double input_signal[],
+                 int order, double coeffs[],
+                 double output_signal[]);
+int convolve_and_compute_power_fft(long length, double input_signal[],
+                                   int order, double coeffs[],
+                                   double* power);
+
+// Polyphase (uniform DFT) channelizer
+// Estimates the power of num_bands equal-width bands covering 0..Fs/2 in a
+// single pass over the signal, instead of one band pass filter and one pass
+// per band. order is the order of the shared low-pass prototype (even).
+// power[] gets num_bands values estimating what convolve_and_compute_power()
+// gives with generate_band_pass() and hamming_window() filters. The filter
+// outputs are the same, but only every num_bands-th one is squared and averaged.
+int channelize_and_compute_power(long length, double input_signal[],
+                                 double Fs, int order, int num_bands,
+                                 double power[]);
+
+// Piece of the above for splitting one signal across threads
+// Adds the sums of squared outputs for frames in [start, end) to pow_sums[]
+// and the number of frames to *frames. power[k] is pow_sums[k] / frames once
+// every piece is in.
+int channelize_power_sums(long length, double input_signal[],
+                          double Fs, int order, int num_bands,
+                          long start, long end,
+                          double pow_sums[], long* frames);
+
+// Welch power spectral density
+// Averages the periodograms of Hann windowed segments of seg_len samples
+// (even; powers of two are fastest), each starting seg_len / 2 after the
+// last. psd[] gets seg_len / 2 + 1 one-sided bins, bin j at j Fs / seg_len,
+// scaled so that they add up to the signal's average power. A signal
+// shorter than one segment is zero padded to one.
+int welch_psd(long length, double input_signal[], int seg_len, double psd[]);
+
+// Pieces of the above for splitting one signal across threads
+// welch_psd_sums() adds the periodograms of segments first <= s < end to
+// psd_sums[]; psd[j] is psd_sums[j] / welch_segments() once every piece is in
+long welch_segments(long length, int seg_len);
+int  welch_psd_sums(long length, double input_signal[], int seg_len,
+                    long first, long end, double psd_sums[]);
+
+// Band powers from a PSD: power[b] integrates psd[] over Fcl[b]..Fch[b],
+// counting a bin partly in the band by the fraction inside. The PSD does
+// not depend on the bands, so any number of them costs one more pass
+// over the bins only.
+void welch_band_power(int seg_len, double psd[], double Fs,
+                      int num_bands, double Fcl[], double Fch[], double power[]);
+
+// Segment length for num_bands equal bands from 0 to Fs/2: order rounded
+// up to a power of two, and longer if needed for WELCH_BINS_PER_BAND bins
+// in every band
+#define WELCH_BINS_PER_BAND 8
+int welch_segment_length(int order, int num_bands);
+
+// Goertzel detector bank
+// power[f] gets the power of the signal at exactly freqs[f] Hz (0 < freqs[f]
+// < Fs/2), as 2 |X(freqs[f])|^2 / length^2, so a sinusoid of amplitude A
+// there reads A^2 / 2. One pass over the signal serves every frequency,
+// and the frequencies run side by side in vector lanes. Resolution is
+// about Fs / length.
+int goertzel_bank(long length, double input_signal[], double Fs,
+                  int num_freqs, double freqs[], double power[]);
+
+// Sliding DFT tracker
+// Power at freqs[] over time: power[t * num_freqs + f] is the goertzel_bank()
+// power at freqs[f] over the window of window samples ending at sample
+// window - 1 + t hop, for the sliding_dft_windows() windows that fit.
+// Each sample updates every frequency once, whatever window is.
+long sliding_dft_windows(long length, int window, int hop);
+int  sliding_dft_power(long length, double input_signal[], double Fs,
+                       int num_freqs, double freqs[], int window, int hop,
+                       double power[]);
+
+// Digital down-conversion band power
+// Estimates the power convolve_and_compute_power() gives for a band pass
+// filter of Fcl..Fch at a reduced rate: the band is mixed down to 0 Hz as
+// a complex signal, decimated by decimation (a power of two) through a
+// cascade of half-band filters, and low-pass filtered by an order filter
+// cutting off at (Fch - Fcl) / 2 at Fs / decimation. Each stage runs at
+// half the rate of the one before, so the whole cascade costs about two
+// half-band filters at the full rate, and the order filter runs at the
+// reduced rate only.
+int ddc_band_power(long length, double input_signal[], double Fs,
+                   double Fcl, double Fch, int order, int decimation,
+                   double* power);
+
+// The largest decimation that keeps the band within DDC_BAND_FRACTION of
+// the decimated rate, so nothing folds into it, up to DDC_MAX_DECIMATION
+#define DDC_BAND_FRACTION  0.8
+#define DDC_MAX_DECIMATION 1024
+int ddc_decimation(double Fs, double Fcl, double Fch);
+
+// The order at the reduced rate with the same transition width in Hz as
+// an order filter at the full rate: order / decimation, kept even and at
+// least DDC_MIN_ORDER
+#define DDC_MIN_ORDER 16
+int ddc_order(int order, int decimation);
+
+// Complex FFT of n points
+// data[] holds n interleaved (real, imaginary) pairs and is transformed in place
+// Powers of two use an iterative radix-2 transform, other sizes use
+// Bluestein's algorithm on top of one
+// Neither direction scales, so inverse(forward(x)) is n*x
+// A plan carries scratch space, so use each plan from one thread at a time
+typedef struct fft_plan_ fft_plan;
+
+fft_plan* fft_plan_create(int n);
+void      fft_plan_destroy(fft_plan* plan);
+void      fft_execute(fft_plan* plan, double data[], int inverse);
+
 /* generate an n-order butterworth low-pass filter
  * [b, a] = butter(n, fcf)
  */
 void butter(int n, double fcf, double** b, double** a);
 
 void filter(int ord, double* a, double* b,
-            int np, double* x, double* y);
+            long np, double* x, double* y);
 
 /* y = filtfilt(b, a, x) */
 void filtfilt(int ord, double* a, double* b,
-              int np, double* x, double* y);
+              long np, double* x, double* y);
 
 
 
@@ -1,25 +1,23 @@
-#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
 #include <assert.h>
-#include <pthread.h>
-#include <sched.h>
+#include <string.h>
 
 #include "timing.h"
 #include "filter.h"
 #include "signal.h"
+#include "seti_engine.h"
 
 #define MAXWIDTH 40
 #define THRESHOLD 2.0
 #define ALIENS_LOW  50000.0
 #define ALIENS_HIGH 150000.0
 
-long numProcs; // number of processors
+long numProcs; // number of processors, 0 = all allowed
 long numThreads;
-pthread_t* tids; // Thread id array
+int policy;    // thread placement policy
 
-// stuff for multi thread processes
 signal* sig;
 int filter_order;
 int num_bands;
@@ -28,25 +26,35 @@ double* upperBand;
 double bandwidth;
 double* band_power;
 int wow;
+int method;
+int numa;      // SIGNAL_NUMA_*
 
 void usage() {
-    printf("usage: p_band_scan text|bin|mmap signal_file Fs filter_order num_bands num_threads num_processors");
+    printf("usage: p_band_scan text|bin|mmap|stream signal_file Fs filter_order num_bands num_threads num_processors|compact|scatter|core|numa [fir|channelizer|welch|ddc] [replicate|interleave] [hugetlb] [cache=file]\n");
+    printf("       hugetlb puts the samples on reserved 2 MB huge pages\n");
+    printf("       cache=file keeps the designed filters in file for the next run\n");
+    printf("       ddc decimates each band as far as its width allows, then filters it\n");
+    printf("       welch sizes its segments from filter_order and num_bands\n");
+    printf("       stream reads a binary signal a block at a time (fir only)\n");
+    printf("       a number of processors spreads threads over that many cpus by core (core)\n");
+    printf("       Fs <= 0 takes the sample rate from a v2 binary file's header\n");
+    printf("       f32 and i16 v2 files are scanned as they are, without widening\n");
 }
 
-double avgPower(double* data, int num) {
+double avgPower(double* data, long num) {
 
   double ss = 0;
-  for (int i = 0; i < num; i++) {
+  for (long i = 0; i < num; i++) {
     ss += data[i] * data[i];
   }
 
   return ss / num;
 }
 
-double maxOf(double* data, int num) {
+double maxOf(double* data, long num) {
 
   double m = data[0];
-  for (int i = 1; i < num; i++) {
+  for (long i = 1; i < num; i++) {
     if (data[i] > m) {
       m = data[i];
     }
@@ -54,74 +62,38 @@ double maxOf(double* data, int num) {
   return m;
 }
 
-double avgOf(double* data, int num) {
+double avgOf(double* data, long num) {
 
   double s = 0;
-  for (int i = 0; i < num; i++) {
+  for (long i = 0; i < num; i++) {
     s += data[i];
   }
   return s / num;
 }
 
-void removeDC(double* data, int num) {
+void removeDC(double* data, long num) {
 
   double dc = avgOf(data,num);
 
   printf("Removing DC component of %lf\n",dc);
 
-  for (int i = 0; i < num; i++) {
+  for (long i = 0; i < num; i++) {
     data[i] -= dc;
   }
 }
 
-void* analyzeBand(void* myId) {
-  // individual id for this thread
-  int id = * (int*) myId;
-  double filter_coeffs[filter_order + 1];
-
-  cpu_set_t set;
-  CPU_ZERO(&set);
-  CPU_SET(id % numProcs, &set);
-  if (sched_setaffinity(0,sizeof(set),&set)<0) {//do it
-    perror("Can't set affinity"); //hopefully doesn't fail
-    exit(-1);
-  } //copied from pthread
-
-
-  for (int band = id; band < num_bands; band += numThreads) {
-    // Make the filter
-    generate_band_pass(sig->Fs,
-                       band * bandwidth + 0.0001, // keep within limits
-                       (band + 1) * bandwidth - 0.0001,
-                       filter_order,
-                       filter_coeffs);
-    hamming_window(filter_order,filter_coeffs);
-
-    // Convolve
-    convolve_and_compute_power(sig->num_samples,
-                               sig->data,
-                               filter_order,
-                               filter_coeffs,
-                               &(band_power[band]));
-
-  }
-
-  pthread_exit(NULL);
-
-}
-
 int analyze_signal(double* lb, double* ub) {
 
   // Pretty print results
   double max_band_power = maxOf(band_power,num_bands);
   double avg_band_power = avgOf(band_power,num_bands);
   wow = 0;
-  *lowerBand = -1;
-  *upperBand = -1;
 
   // set up globals
   lowerBand = lb;
   upperBand = ub;
+  *lowerBand = -1;
+  *upperBand = -1;
 
   for (int band = 0; band < num_bands; band++) {
     double band_low  = band * bandwidth + 0.0001;
@@ -160,7 +132,7 @@ int analyze_signal(double* lb, double* ub) {
 
 int main(int argc, char* argv[]) {
 
-  if (argc != 8) {
+  if (argc < 8) {
     usage();
     return -1;
   }
@@ -171,19 +143,70 @@ int main(int argc, char* argv[]) {
   filter_order = atoi(argv[4]);
   num_bands    = atoi(argv[5]);
   numThreads = atoi(argv[6]);
-  numProcs = atoi(argv[7]);
-
-  if (numThreads > num_bands) {numThreads = num_bands;}
+  if (isdigit(argv[7][0])) {
+    numProcs = atoi(argv[7]);
+    policy   = PLACE_CORE;
+  } else {
+    numProcs = 0;
+    policy   = placement_parse(argv[7]);
+    if (policy < 0) {
+      usage();
+      return -1;
+    }
+  }
+  method = SETI_METHOD_FIR;
+  numa   = SIGNAL_NUMA_NONE;
+  char* cache_file = 0;
+
+  for (int i = 8; i < argc; i++) {
+    if (!strcmp(argv[i], "channelizer")) {
+      method = SETI_METHOD_CHANNELIZER;
+    } else if (!strcmp(argv[i], "welch")) {
+      method = SETI_METHOD_WELCH;
+    } else if (!strcmp(argv[i], "ddc")) {
+      method = SETI_METHOD_DDC;
+    } else if (!strcmp(argv[i], "fir")) {
+      method = SETI_METHOD_FIR;
+    } else if (!strcmp(argv[i], "replicate")) {
+      numa = SIGNAL_NUMA_REPLICATE;
+    } else if (!strcmp(argv[i], "interleave")) {
+      numa = SIGNAL_NUMA_INTERLEAVE;
+    } else if (!strcmp(argv[i], "hugetlb")) {
+      set_signal_hugepages(SIGNAL_HUGEPAGES_2MB);
+    } else if (!strncmp(argv[i], "cache=", 6)) {
+      cache_file = argv[i] + 6;
+    } else {
+      usage();
+      return -1;
+    }
+  }
 
-  tids = (pthread_t*) malloc(sizeof(pthread_t) * numThreads);
   band_power = (double*) malloc(sizeof(double)*num_bands);
 
+  // a missing cache file is just an empty cache
+  if (cache_file) {
+    filter_cache_load(cache_file);
+  }
+
+
+  // a v2 binary file knows its own sample rate
+  if (Fs <= 0.0 && sig_type != 'T') {
+    signal_info info;
+    if (read_signal_info(sig_file, &info)) {
+      printf("Unable to read file header\n");
+      return -1;
+    }
+    Fs = info.Fs;
+  }
+  if (Fs <= 0.0) {
+    printf("No sample rate given and none in the file\n");
+    return -1;
+  }
 
-  assert(Fs > 0.0);
   assert(filter_order > 0 && !(filter_order & 0x1));
   assert(num_bands > 0);
   assert(numThreads > 0);
-  assert(numProcs > 0);
+  assert(numProcs >= 0);
 
   printf("type:       %s\n\
           file:       %s\n\
@@ -191,70 +214,110 @@ int main(int argc, char* argv[]) {
           order:      %d\n\
           bands:      %d\n\
           Threads:    %ld\n\
-          Processors: %ld\n",
-         sig_type == 'T' ? "Text" : (sig_type == 'B' ? "Binary" : (sig_type == 'M' ? "Mapped Binary" : "UNKNOWN TYPE")),
+          Processors: %ld\n\
+          Placement:  %s\n\
+          Method:     %s\n\
+          NUMA:       %s\n",
+         sig_type == 'T' ? "Text" : (sig_type == 'B' ? "Binary" : (sig_type == 'M' ? "Mapped Binary" : (sig_type == 'S' ? "Streamed Binary" : "UNKNOWN TYPE"))),
          sig_file,
          Fs,
          filter_order,
          num_bands,
          numThreads,
-         numProcs);
-
-  printf("Load or map file\n");
+         numProcs,
+         placement_name(policy),
+         method == SETI_METHOD_CHANNELIZER ? "Channelizer" : (method == SETI_METHOD_WELCH ? "Welch" : (method == SETI_METHOD_DDC ? "DDC" : "FIR")),
+         numa == SIGNAL_NUMA_REPLICATE ? "replicate" : (numa == SIGNAL_NUMA_INTERLEAVE ? "interleave" : "none"));
 
-  switch (sig_type) {
-    case 'T':
-      sig = load_text_format_signal(sig_file);
-      break;
+  double Fc = Fs / 2;
+  bandwidth = Fc / num_bands;
 
-    case 'B':
-      sig = load_binary_format_signal(sig_file);
-      break;
+  // the engine's threads are started and pinned once; a long running
+  // scanner would keep it around for every signal it scans
+  placement* place = placement_create(policy, numThreads, numProcs);
+  seti_engine* engine = place ? seti_engine_create(numThreads, place) : 0;
+  if (!engine) {
+    printf("Unable to start scan engine\n");
+    return -1;
+  }
 
-    case 'M':
-      sig = map_binary_format_signal(sig_file);
-      break;
+  seti_params params = { filter_order, num_bands, method, numa };
+  seti_results results = { band_power };
+  sig = 0;
 
-    default:
-      printf("Unknown signal type\n");
+  if (sig_type == 'S') {
+    if (method != SETI_METHOD_FIR) {
+      printf("Stream mode only supports fir\n");
       return -1;
-  }
+    }
+    if (seti_scan_stream(engine, sig_file, Fs, &params, &results)) {
+      printf("Scan failed\n");
+      return -1;
+    }
+    printf("Streamed %ld samples\n", results.num_samples);
+    printf("Removing DC component of %lf\n", results.dc);
+    printf("signal average power:     %lf\n", results.signal_power);
+  } else {
+    printf("Load or map file\n");
 
-  if (!sig) {
-    printf("Unable to load or map file\n");
-    return -1;
-  }
+    switch (sig_type) {
+      case 'T':
+        sig = load_text_format_signal(sig_file);
+        break;
 
-  sig->Fs = Fs;
+      case 'B':
+        sig = load_binary_format_signal(sig_file);
+        break;
 
-  // processing before multi parallelizing
-  double Fc = (sig->Fs) / 2;
-  bandwidth = Fc / num_bands;
-  removeDC(sig->data,sig->num_samples);
-  double signal_power = avgPower(sig->data,sig->num_samples);
-  printf("signal average power:     %lf\n", signal_power);
-
-  long returnCode;
-  for (int i = 0; i < numThreads; i++) {
-    returnCode = pthread_create(&(tids[i]),
-                                NULL,
-                                analyzeBand,
-                                (void*) &i);
-    if (returnCode != 0) {
-      perror("failed to start thread");
-      exit(-1);
+      case 'M':
+        sig = map_binary_format_signal(sig_file);
+        break;
+
+      default:
+        printf("Unknown signal type\n");
+        return -1;
+    }
+
+    if (!sig) {
+      printf("Unable to load or map file\n");
+      return -1;
     }
-  }
-  
 
-  for (int i = 0; i < numThreads; i++) {
-    returnCode = pthread_join(tids[i], NULL);
-    if (returnCode != 0) { 
-      perror("join failed");
-      exit(-1);
+    sig->Fs = Fs;
+
+    // only fir takes narrow samples, and NUMA replicas are doubles too
+    if ((method != SETI_METHOD_FIR || numa == SIGNAL_NUMA_REPLICATE) &&
+        widen_signal(sig)) {
+      printf("Unable to widen signal\n");
+      return -1;
+    }
+
+    // processing before multi parallelizing
+    double dc;
+    double signal_power;
+    if (sig->sample_type == SIGNAL_SAMPLE_F64 && signal_summary_stats(sig, &dc, &signal_power)) {
+      removeDC(sig->data,sig->num_samples);
+      signal_power = avgPower(sig->data,sig->num_samples);
+    } else {
+      // the file's summaries already have both, which saves two passes;
+      // narrow samples get both in one pass
+      if (signal_summary_stats(sig, &dc, &signal_power)) {
+        signal_stats(sig, &dc, &signal_power);
       }
+      printf("Removing DC component of %lf\n",dc);
+      remove_signal_dc(sig, dc);
+    }
+    printf("signal average power:     %lf\n", signal_power);
+
+    if (seti_scan(engine, sig, &params, &results)) {
+      printf("Scan failed\n");
+      return -1;
+    }
   }
 
+  seti_engine_destroy(engine);
+  placement_destroy(place);
+
   double start = 0;
   double end   = 0;
   if (analyze_signal(&start, &end)) {
@@ -265,8 +328,11 @@ int main(int argc, char* argv[]) {
 
 
   free_signal(sig);
-  free(tids);
   free(band_power);
 
+  if (cache_file) {
+    filter_cache_save(cache_file);
+  }
+
   return 0;
 }
\ No newline at end of file
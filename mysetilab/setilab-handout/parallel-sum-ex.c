@@ -6,12 +6,15 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#include "placement.h" // which cpus each thread runs on
+
 int vector_len;       // length of vector we will sum
 double* vector;       // the vector we will sum
 
 int num_threads;            // number of threads we will use
 int num_processors;         // number of processors we will use
 pthread_t* tid;             // array of thread ids
+placement* place;           // where each thread runs
 double* partial_sum;        // partial sums, one for each processor
 
 
@@ -35,11 +38,8 @@ void* worker(void* arg) {
   long myid     = (long)arg;
   int blocksize = vector_len / num_threads; // note: floor
 
-  // put ourselves on the desired processor
-  cpu_set_t set;
-  CPU_ZERO(&set);
-  CPU_SET(myid % num_processors, &set);
-  if (sched_setaffinity(0, sizeof(set), &set) < 0) { // do it
+  // put ourselves on the processor the placement policy picked
+  if (placement_bind_self(place, myid) < 0) { // do it
     perror("Can't setaffinity"); // hopefully doesn't fail
     exit(-1);
   }
@@ -74,8 +74,8 @@ void* worker(void* arg) {
 
 
 int main(int argc, char* argv[]) {
-  if (argc != 4) {
-    fprintf(stderr, "usage: parallel-sum-ex number-of-threads number-of-procs length-of-vector\n");
+  if (argc != 4 && argc != 5) {
+    fprintf(stderr, "usage: parallel-sum-ex number-of-threads number-of-procs length-of-vector [compact|scatter|core|numa|none]\n");
     exit(-1);
   }
 
@@ -83,11 +83,20 @@ int main(int argc, char* argv[]) {
   num_processors = atoi(argv[2]); // numer of processors to use
   vector_len  = atoi(argv[3]);    // length of vector to sum
 
+  // core spreads threads over the first num_processors cpus we are
+  // allowed to use, one per physical core before any SMT siblings
+  int policy = argc == 5 ? placement_parse(argv[4]) : PLACE_CORE;
+  if (policy < 0) {
+    fprintf(stderr, "unknown placement policy %s\n", argv[4]);
+    exit(-1);
+  }
+  place = placement_create(policy, num_threads, num_processors);
+
   vector      = (double*)malloc(sizeof(double) * vector_len);
   tid         = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
   partial_sum = (double*)malloc(sizeof(double) * num_threads);
 
-  if (!vector || !tid || !partial_sum) {
+  if (!vector || !tid || !partial_sum || !place) {
     fprintf(stderr, "cannot allocate memory\n");
     exit(-1);
   }
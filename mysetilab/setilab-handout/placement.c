@@ -0,0 +1,304 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <sched.h>
+
+#include "placement.h"
+
+typedef struct cpu_info_ {
+  int cpu;
+  int package;   // socket
+  int core;      // core id within the package
+  int node;      // dense NUMA node index
+  int sibling;   // rank among the SMT siblings of its core
+  int core_rank; // rank of its core within the package
+} cpu_info;
+
+struct placement_ {
+  placement_policy policy;
+  int num_threads;
+  int num_nodes;
+  cpu_set_t* sets;  // one per thread
+  int* nodes;       // one per thread
+};
+
+static const char* policy_names[] = { "none", "compact", "scatter", "core", "numa" };
+
+int placement_parse(const char* name) {
+  for (int i = 0; i < (int)(sizeof(policy_names) / sizeof(policy_names[0])); i++) {
+    if (!strcmp(name, policy_names[i])) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+const char* placement_name(placement_policy policy) {
+  return policy_names[policy];
+}
+
+// Reads one integer from a sysfs file, or returns dflt if that fails
+static int read_sys_int(int cpu, const char* what, int dflt) {
+  char path[128];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, what);
+
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    return dflt;
+  }
+  int v;
+  if (fscanf(f, "%d", &v) != 1) {
+    v = dflt;
+  }
+  fclose(f);
+  return v;
+}
+
+// Parses a cpulist like "0-3,8-11" into set
+static int read_cpulist(const char* path, cpu_set_t* set) {
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    return -1;
+  }
+
+  CPU_ZERO(set);
+  int lo, hi;
+  char sep;
+  while (fscanf(f, "%d", &lo) == 1) {
+    hi = lo;
+    if (fscanf(f, "%c", &sep) == 1 && sep == '-') {
+      if (fscanf(f, "%d", &hi) != 1) {
+        break;
+      }
+      if (fscanf(f, "%c", &sep) != 1) {
+        sep = '\n';
+      }
+    }
+    for (int c = lo; c <= hi && c < CPU_SETSIZE; c++) {
+      CPU_SET(c, set);
+    }
+    if (sep != ',') {
+      break;
+    }
+  }
+
+  fclose(f);
+  return 0;
+}
+
+// Fills in node for each cpu from /sys/devices/system/node, numbering the
+// nodes that have usable cpus 0, 1, ... Returns the number of such nodes
+static int read_nodes(cpu_info cpus[], int n) {
+  for (int i = 0; i < n; i++) {
+    cpus[i].node = -1;
+  }
+
+  int num_nodes = 0;
+  DIR* d = opendir("/sys/devices/system/node");
+  if (d) {
+    // readdir order is arbitrary, so go by node number
+    int max_node = -1;
+    struct dirent* ent;
+    while ((ent = readdir(d))) {
+      int id;
+      if (sscanf(ent->d_name, "node%d", &id) == 1 && id > max_node) {
+        max_node = id;
+      }
+    }
+    closedir(d);
+
+    for (int id = 0; id <= max_node; id++) {
+      char path[128];
+      cpu_set_t set;
+      snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", id);
+      if (read_cpulist(path, &set)) {
+        continue;
+      }
+      int used = 0;
+      for (int i = 0; i < n; i++) {
+        if (cpus[i].node < 0 && CPU_ISSET(cpus[i].cpu, &set)) {
+          cpus[i].node = num_nodes;
+          used = 1;
+        }
+      }
+      num_nodes += used;
+    }
+  }
+
+  // no NUMA information: everything is one node
+  if (num_nodes == 0) {
+    num_nodes = 1;
+  }
+  for (int i = 0; i < n; i++) {
+    if (cpus[i].node < 0) {
+      cpus[i].node = 0;
+    }
+  }
+  return num_nodes;
+}
+
+static int cmp_compact(const void* a, const void* b) {
+  const cpu_info* x = a;
+  const cpu_info* y = b;
+  if (x->package != y->package) return x->package - y->package;
+  if (x->core != y->core)       return x->core - y->core;
+  return x->cpu - y->cpu;
+}
+
+static int cmp_scatter(const void* a, const void* b) {
+  const cpu_info* x = a;
+  const cpu_info* y = b;
+  if (x->sibling != y->sibling)     return x->sibling - y->sibling;
+  if (x->core_rank != y->core_rank) return x->core_rank - y->core_rank;
+  if (x->package != y->package)     return x->package - y->package;
+  return x->cpu - y->cpu;
+}
+
+static int cmp_core(const void* a, const void* b) {
+  const cpu_info* x = a;
+  const cpu_info* y = b;
+  if (x->sibling != y->sibling) return x->sibling - y->sibling;
+  return cmp_compact(a, b);
+}
+
+placement* placement_create(placement_policy policy, int num_threads, int max_cpus) {
+
+  if (num_threads <= 0 || policy < PLACE_NONE || policy > PLACE_NUMA) {
+    return 0;
+  }
+
+  placement* p = (placement*)calloc(1, sizeof(placement));
+  if (!p) {
+    return 0;
+  }
+  p->policy      = policy;
+  p->num_threads = num_threads;
+  p->num_nodes   = 1;
+  p->sets        = (cpu_set_t*)calloc(num_threads, sizeof(cpu_set_t));
+  p->nodes       = (int*)calloc(num_threads, sizeof(int));
+  if (!p->sets || !p->nodes) {
+    placement_destroy(p);
+    return 0;
+  }
+  if (policy == PLACE_NONE) {
+    return p;
+  }
+
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+    perror("Can't get affinity");
+    placement_destroy(p);
+    return 0;
+  }
+
+  int n = CPU_COUNT(&allowed);
+  cpu_info* cpus = (cpu_info*)malloc(sizeof(cpu_info) * n);
+  if (!cpus) {
+    placement_destroy(p);
+    return 0;
+  }
+  n = 0;
+  for (int c = 0; c < CPU_SETSIZE; c++) {
+    if (CPU_ISSET(c, &allowed)) {
+      cpus[n].cpu     = c;
+      cpus[n].package = read_sys_int(c, "physical_package_id", 0);
+      cpus[n].core    = read_sys_int(c, "core_id", c);
+      n++;
+    }
+  }
+  int num_nodes = read_nodes(cpus, n);
+
+  // sibling and core ranks, from the compact order
+  qsort(cpus, n, sizeof(cpu_info), cmp_compact);
+  for (int i = 0, rank = 0; i < n; i++) {
+    int same_core = i > 0 && cpus[i].package == cpus[i - 1].package &&
+                    cpus[i].core == cpus[i - 1].core;
+    if (i > 0 && cpus[i].package != cpus[i - 1].package) {
+      rank = 0;
+    } else if (i > 0 && !same_core) {
+      rank++;
+    }
+    cpus[i].sibling   = same_core ? cpus[i - 1].sibling + 1 : 0;
+    cpus[i].core_rank = rank;
+  }
+
+  if (policy == PLACE_SCATTER) {
+    qsort(cpus, n, sizeof(cpu_info), cmp_scatter);
+  } else if (policy == PLACE_CORE) {
+    qsort(cpus, n, sizeof(cpu_info), cmp_core);
+  }
+  if (max_cpus > 0 && max_cpus < n) {
+    n = max_cpus;
+  }
+
+  if (policy == PLACE_NUMA) {
+    // only nodes that still have cpus after max_cpus
+    int* dense = (int*)malloc(sizeof(int) * num_nodes);
+    int used = 0;
+    for (int k = 0; k < num_nodes; k++) {
+      dense[k] = -1;
+    }
+    for (int i = 0; i < n; i++) {
+      if (dense[cpus[i].node] < 0) {
+        dense[cpus[i].node] = used++;
+      }
+    }
+    p->num_nodes = used;
+    for (int t = 0; t < num_threads; t++) {
+      int node = t % used;
+      CPU_ZERO(&(p->sets[t]));
+      for (int i = 0; i < n; i++) {
+        if (dense[cpus[i].node] == node) {
+          CPU_SET(cpus[i].cpu, &(p->sets[t]));
+        }
+      }
+      p->nodes[t] = node;
+    }
+    free(dense);
+  } else {
+    p->num_nodes = num_nodes;
+    for (int t = 0; t < num_threads; t++) {
+      cpu_info* c = &cpus[t % n];
+      CPU_ZERO(&(p->sets[t]));
+      CPU_SET(c->cpu, &(p->sets[t]));
+      p->nodes[t] = c->node;
+    }
+  }
+
+  free(cpus);
+  return p;
+}
+
+void placement_destroy(placement* p) {
+  if (p) {
+    free(p->sets);
+    free(p->nodes);
+    free(p);
+  }
+}
+
+int placement_cpuset(placement* p, int thread, cpu_set_t* set) {
+  if (!p || p->policy == PLACE_NONE) {
+    return -1;
+  }
+  *set = p->sets[thread % p->num_threads];
+  return 0;
+}
+
+int placement_bind_self(placement* p, int thread) {
+  cpu_set_t set;
+  if (placement_cpuset(p, thread, &set)) {
+    return 0;
+  }
+  return sched_setaffinity(0, sizeof(set), &set);
+}
+
+int placement_node(placement* p, int thread) {
+  return p ? p->nodes[thread % p->num_threads] : 0;
+}
+
+int placement_num_nodes(placement* p) {
+  return p ? p->num_nodes : 1;
+}
@@ -0,0 +1,43 @@
+#ifndef _placement
+#define _placement
+
+#include <sched.h> // cpu_set_t; users need _GNU_SOURCE for the CPU_* macros
+
+// Thread placement
+//
+// Works out which CPUs each of a set of threads should run on, from the
+// topology in /sys/devices/system/cpu and /sys/devices/system/node.
+// Only CPUs in the process's affinity mask (sched_getaffinity) are used,
+// so this also does the right thing inside a restricted cpuset or cgroup.
+
+typedef enum {
+  PLACE_NONE,    // don't pin
+  PLACE_COMPACT, // fill a core's SMT siblings, then the next core, then the next socket
+  PLACE_SCATTER, // spread across sockets first, then cores, then siblings
+  PLACE_CORE,    // one thread per physical core; siblings only once every core has one
+  PLACE_NUMA     // round robin over NUMA nodes, each thread may use its whole node
+} placement_policy;
+
+typedef struct placement_ placement;
+
+// Returns the policy named by name (none, compact, scatter, core, numa),
+// or -1 if there is no such policy
+int placement_parse(const char* name);
+const char* placement_name(placement_policy policy);
+
+// Placement for num_threads threads. If max_cpus > 0 only the first
+// max_cpus CPUs in the policy's order are used. Returns 0 on failure
+placement* placement_create(placement_policy policy, int num_threads, int max_cpus);
+void       placement_destroy(placement* p);
+
+// CPUs thread may run on. Returns 0 if it should be pinned, -1 if not (PLACE_NONE)
+int placement_cpuset(placement* p, int thread, cpu_set_t* set);
+
+// Pins the calling thread as thread. Returns 0 on success (or PLACE_NONE)
+int placement_bind_self(placement* p, int thread);
+
+// NUMA node thread runs on, 0 .. placement_num_nodes() - 1
+int placement_node(placement* p, int thread);
+int placement_num_nodes(placement* p);
+
+#endif
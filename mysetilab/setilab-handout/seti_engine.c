@@ -0,0 +1,629 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "filter.h"
+#include "seti_engine.h"
+
+// FIR scans are cut into tasks of one band group over one time block.
+// Workers take the next task from a shared counter until none are left,
+// so a slow or late thread never leaves bands unscanned at the end.
+//
+// Time blocks are sized so there are about TASKS_PER_THREAD tasks for each
+// thread, which lets few-band scans use every core. Each block rereads the
+// order samples of history before it, so blocks stay at least
+// MIN_BLOCK_ORDERS orders long to keep that overlap small.
+#define BAND_GROUP 8          // bands run together as one filter bank
+#define TASKS_PER_THREAD 4
+#define MIN_BLOCK 4096        // samples
+#define MIN_BLOCK_ORDERS 16
+
+// Welch scans split the segments into WELCH_TASKS runs with their own
+// sums, whatever the number of threads, so the results don't depend on it
+#define WELCH_TASKS 64
+
+// What the workers do when woken
+#define PHASE_REPLICATE 0 // copy the samples to their node's replica
+#define PHASE_SCAN      1 // compute band powers
+#define PHASE_STREAM    2 // push the current block into each group's stream
+
+typedef struct seti_worker_ {
+  seti_engine* engine;
+  int id;
+  int node;      // NUMA node the worker is placed on
+  int node_rank; // index among the workers on that node
+  pthread_t tid;
+} seti_worker;
+
+struct seti_engine_ {
+  int nthreads;
+  int started;           // workers actually running
+  seti_worker* workers;
+  int num_nodes;
+  int* node_workers;     // workers per node
+
+  pthread_mutex_t lock;
+  pthread_cond_t work;   // workers wait here for the next scan
+  pthread_cond_t done;   // seti_scan() waits here for the workers
+  unsigned long generation; // bumped once per scan
+  int pending;           // workers not yet finished with this scan
+  int shutdown;
+
+  pthread_mutex_t scan_lock; // one scan at a time per engine
+
+  // the scan in progress
+  int phase;
+  signal* sig;
+  seti_params params;
+  int replicated;        // workers read signal_replica() for their node
+  double* coeffs;        // num_bands x (filter_order + 1)
+  double* task_sums;     // per-task power sums, num_tasks x BAND_GROUP
+  int num_blocks;
+  int num_tasks;
+  long block_len;
+  atomic_int next_task;
+  atomic_int failed;
+  double* chan_sums;     // per-thread channelizer sums, nthreads x num_bands
+  long* chan_frames;     // per-thread channelizer frame counts
+  int welch_len;         // welch segment length
+  double* welch_sums;    // per-task periodogram sums, num_tasks x (welch_len/2 + 1)
+
+  // the stream scan in progress
+  fir_stream** streams;  // one per band group
+  int num_groups;
+  double* block;         // current block of samples
+  long block_count;
+};
+
+// Samples per block read by seti_scan_stream()
+#define STREAM_BLOCK (1 << 20)
+
+
+// Each node's workers split the copy into that node's replica between them
+static void run_replicate(seti_engine* e, seti_worker* w) {
+  long length = e->sig->num_samples;
+  int count   = e->node_workers[w->node];
+  fill_signal_replica(e->sig, w->node,
+                      length * w->node_rank / count,
+                      length * (w->node_rank + 1) / count);
+}
+
+// The samples as seen from w's node
+static double* worker_data(seti_engine* e, seti_worker* w) {
+  return e->replicated ? signal_replica(e->sig, w->node) : e->sig->data;
+}
+
+static void run_fir_tasks(seti_engine* e, seti_worker* w) {
+  signal* sig   = e->sig;
+  int order     = e->params.filter_order;
+  int num_bands = e->params.num_bands;
+  long length   = sig->num_samples;
+  double* data  = worker_data(e, w);
+
+  for (;;) {
+    int task = atomic_fetch_add(&e->next_task, 1);
+    if (task >= e->num_tasks) {
+      break;
+    }
+
+    // consecutive tasks share a group, so a thread keeps its filters warm
+    int group = task / e->num_blocks;
+    int block = task % e->num_blocks;
+    int first = group * BAND_GROUP;
+    int count = (num_bands - first < BAND_GROUP) ? num_bands - first : BAND_GROUP;
+    long start = block * e->block_len;
+    long end   = (length - start < e->block_len) ? length : start + e->block_len;
+
+    double (*coeffs)[order + 1] = (double (*)[order + 1]) &(e->coeffs[first * (order + 1)]);
+    double* sums = &(e->task_sums[task * BAND_GROUP]);
+    int rc;
+    if (sig->sample_type == SIGNAL_SAMPLE_F32) {
+      rc = convolve_bank_power_sums_f32(length, sig->data_f32, order, count, coeffs,
+                                        start, end, sums);
+    } else if (sig->sample_type == SIGNAL_SAMPLE_I16) {
+      rc = convolve_bank_power_sums_i16(length, sig->data_i16, sig->scale, sig->offset,
+                                        order, count, coeffs, start, end, sums);
+    } else {
+      rc = convolve_bank_power_sums(length, data, order, count, coeffs, start, end, sums);
+    }
+    if (rc) {
+      atomic_store(&e->failed, 1);
+    }
+  }
+}
+
+// Each thread runs the channelizer over its own slice of time
+static void run_channels(seti_engine* e, seti_worker* w) {
+  int id        = w->id;
+  int num_bands = e->params.num_bands;
+  long start = e->sig->num_samples * id / e->nthreads;
+  long end   = e->sig->num_samples * (id + 1) / e->nthreads;
+
+  if (channelize_power_sums(e->sig->num_samples, worker_data(e, w), e->sig->Fs,
+                            e->params.filter_order, num_bands, start, end,
+                            &(e->chan_sums[id * num_bands]), &(e->chan_frames[id]))) {
+    atomic_store(&e->failed, 1);
+  }
+}
+
+// Each task adds the periodograms of its run of segments
+static void run_welch_tasks(seti_engine* e, seti_worker* w) {
+  long length   = e->sig->num_samples;
+  long segments = welch_segments(length, e->welch_len);
+  int bins      = e->welch_len / 2 + 1;
+
+  for (;;) {
+    int task = atomic_fetch_add(&e->next_task, 1);
+    if (task >= e->num_tasks) {
+      break;
+    }
+    long first = segments * task / e->num_tasks;
+    long end   = segments * (task + 1) / e->num_tasks;
+    if (welch_psd_sums(length, worker_data(e, w), e->welch_len, first, end,
+                       &(e->welch_sums[(size_t)task * bins]))) {
+      atomic_store(&e->failed, 1);
+    }
+  }
+}
+
+// Each task is one band, down-converted by as much as its width allows
+static void run_ddc_tasks(seti_engine* e, seti_worker* w) {
+  double Fs = e->sig->Fs;
+  double bandwidth = (Fs / 2) / e->params.num_bands;
+
+  for (;;) {
+    int band = atomic_fetch_add(&e->next_task, 1);
+    if (band >= e->num_tasks) {
+      break;
+    }
+    double low  = band * bandwidth + 0.0001; // same edges as the filters
+    double high = (band + 1) * bandwidth - 0.0001;
+    int decimation = ddc_decimation(Fs, low, high);
+    if (ddc_band_power(e->sig->num_samples, worker_data(e, w), Fs, low, high,
+                       ddc_order(e->params.filter_order, decimation), decimation,
+                       &(e->task_sums[band]))) {
+      atomic_store(&e->failed, 1);
+    }
+  }
+}
+
+// Each band group's stream takes the block; groups are independent
+static void run_stream_groups(seti_engine* e) {
+  for (;;) {
+    int group = atomic_fetch_add(&e->next_task, 1);
+    if (group >= e->num_groups) {
+      break;
+    }
+    if (fir_stream_push(e->streams[group], e->block_count, e->block)) {
+      atomic_store(&e->failed, 1);
+    }
+  }
+}
+
+static void* seti_worker_main(void* arg) {
+  seti_worker* w = (seti_worker*)arg;
+  seti_engine* e = w->engine;
+  unsigned long seen = 0;
+
+  pthread_mutex_lock(&e->lock);
+  for (;;) {
+    while (!e->shutdown && e->generation == seen) {
+      pthread_cond_wait(&e->work, &e->lock);
+    }
+    if (e->shutdown) {
+      break;
+    }
+    seen = e->generation;
+    pthread_mutex_unlock(&e->lock);
+
+    if (e->phase == PHASE_REPLICATE) {
+      run_replicate(e, w);
+    } else if (e->phase == PHASE_STREAM) {
+      run_stream_groups(e);
+    } else if (e->params.method == SETI_METHOD_CHANNELIZER) {
+      run_channels(e, w);
+    } else if (e->params.method == SETI_METHOD_WELCH) {
+      run_welch_tasks(e, w);
+    } else if (e->params.method == SETI_METHOD_DDC) {
+      run_ddc_tasks(e, w);
+    } else {
+      run_fir_tasks(e, w);
+    }
+
+    pthread_mutex_lock(&e->lock);
+    if (--e->pending == 0) {
+      pthread_cond_signal(&e->done);
+    }
+  }
+  pthread_mutex_unlock(&e->lock);
+
+  return NULL;
+}
+
+
+seti_engine* seti_engine_create(int nthreads, placement* affinity) {
+
+  if (nthreads <= 0) {
+    return 0;
+  }
+
+  seti_engine* e = (seti_engine*)calloc(1, sizeof(seti_engine));
+  if (!e) {
+    perror("Not enough memory");
+    return 0;
+  }
+  e->nthreads = nthreads;
+  e->workers  = (seti_worker*)calloc(nthreads, sizeof(seti_worker));
+  e->num_nodes = placement_num_nodes(affinity);
+  e->node_workers = (int*)calloc(e->num_nodes, sizeof(int));
+  if (!e->workers || !e->node_workers) {
+    perror("Not enough memory");
+    free(e->workers);
+    free(e->node_workers);
+    free(e);
+    return 0;
+  }
+  for (int i = 0; i < nthreads; i++) {
+    e->workers[i].node      = placement_node(affinity, i);
+    e->workers[i].node_rank = e->node_workers[e->workers[i].node]++;
+  }
+
+  pthread_mutex_init(&e->lock, NULL);
+  pthread_mutex_init(&e->scan_lock, NULL);
+  pthread_cond_init(&e->work, NULL);
+  pthread_cond_init(&e->done, NULL);
+
+  for (int i = 0; i < nthreads; i++) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+
+    // pinned from the start, so the thread never runs anywhere else
+    cpu_set_t set;
+    if (placement_cpuset(affinity, i, &set) == 0) {
+      pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    }
+
+    e->workers[i].engine = e;
+    e->workers[i].id     = i;
+    int rc = pthread_create(&(e->workers[i].tid), &attr, seti_worker_main, &(e->workers[i]));
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+      fprintf(stderr, "failed to start thread\n");
+      seti_engine_destroy(e);
+      return 0;
+    }
+    e->started++;
+  }
+
+  return e;
+}
+
+
+void seti_engine_destroy(seti_engine* e) {
+  if (!e) {
+    return;
+  }
+
+  pthread_mutex_lock(&e->lock);
+  e->shutdown = 1;
+  pthread_cond_broadcast(&e->work);
+  pthread_mutex_unlock(&e->lock);
+
+  for (int i = 0; i < e->started; i++) {
+    pthread_join(e->workers[i].tid, NULL);
+  }
+
+  pthread_cond_destroy(&e->work);
+  pthread_cond_destroy(&e->done);
+  pthread_mutex_destroy(&e->lock);
+  pthread_mutex_destroy(&e->scan_lock);
+  free(e->workers);
+  free(e->node_workers);
+  free(e);
+}
+
+
+// Makes the band pass filter for each band into e->coeffs, through the
+// filter cache, so repeated scans with the same parameters only copy them
+static int make_filters(seti_engine* e, double Fs) {
+  int order     = e->params.filter_order;
+  int num_bands = e->params.num_bands;
+  double bandwidth = (Fs / 2) / num_bands;
+
+  e->coeffs = (double*)malloc(sizeof(double) * (order + 1) * num_bands);
+  double* low  = (double*)malloc(sizeof(double) * num_bands);
+  double* high = (double*)malloc(sizeof(double) * num_bands);
+  int rc = (e->coeffs && low && high) ? 0 : -1;
+  for (int band = 0; band < num_bands && rc == 0; band++) {
+    low[band]  = band * bandwidth + 0.0001; // keep within limits
+    high[band] = (band + 1) * bandwidth - 0.0001;
+  }
+  if (rc == 0) {
+    rc = cached_band_pass_bank(Fs, order, num_bands, low, high, FILTER_WINDOW_HAMMING,
+                               (double (*)[order + 1]) e->coeffs);
+  }
+  free(low);
+  free(high);
+  return rc;
+}
+
+// Sets up the FIR tasks for the current scan
+static int prepare_fir(seti_engine* e) {
+  signal* sig   = e->sig;
+  int order     = e->params.filter_order;
+  int num_bands = e->params.num_bands;
+
+  // Make the filters up front; the tasks only convolve
+  if (make_filters(e, sig->Fs)) {
+    return -1;
+  }
+
+  int num_groups   = (num_bands + BAND_GROUP - 1) / BAND_GROUP;
+  long want_blocks = ((long)TASKS_PER_THREAD * e->nthreads + num_groups - 1) / num_groups;
+  long min_len     = (long)MIN_BLOCK_ORDERS * order;
+  if (min_len < MIN_BLOCK) {
+    min_len = MIN_BLOCK;
+  }
+  e->block_len = (sig->num_samples + want_blocks - 1) / want_blocks;
+  if (e->block_len < min_len) {
+    e->block_len = min_len;
+  }
+  e->num_blocks = (sig->num_samples + e->block_len - 1) / e->block_len;
+  if (e->num_blocks < 1) {
+    e->num_blocks = 1;
+  }
+  e->num_tasks = num_groups * e->num_blocks;
+  e->task_sums = (double*)calloc((size_t)e->num_tasks * BAND_GROUP, sizeof(double));
+  if (!e->task_sums) {
+    return -1;
+  }
+  atomic_store(&e->next_task, 0);
+
+  return 0;
+}
+
+// Sets up the welch tasks for the current scan
+static int prepare_welch(seti_engine* e) {
+  e->welch_len = welch_segment_length(e->params.filter_order, e->params.num_bands);
+  long segments = welch_segments(e->sig->num_samples, e->welch_len);
+  e->num_tasks  = segments < WELCH_TASKS ? segments : WELCH_TASKS;
+  e->welch_sums = (double*)calloc((size_t)e->num_tasks * (e->welch_len / 2 + 1), sizeof(double));
+  if (!e->welch_sums) {
+    return -1;
+  }
+  atomic_store(&e->next_task, 0);
+
+  return 0;
+}
+
+// Combines the partial sums in task or thread order, so results
+// don't depend on which thread ran which piece
+static int reduce(seti_engine* e, double band_power[]) {
+  int num_bands = e->params.num_bands;
+
+  if (e->params.method == SETI_METHOD_DDC) {
+    for (int band = 0; band < num_bands; band++) {
+      band_power[band] = e->task_sums[band];
+    }
+  } else if (e->params.method == SETI_METHOD_WELCH) {
+    int bins = e->welch_len / 2 + 1;
+    long segments = welch_segments(e->sig->num_samples, e->welch_len);
+    double* psd  = (double*)calloc(bins, sizeof(double));
+    double* low  = (double*)malloc(sizeof(double) * num_bands);
+    double* high = (double*)malloc(sizeof(double) * num_bands);
+    if (!psd || !low || !high) {
+      free(psd);
+      free(low);
+      free(high);
+      return -1;
+    }
+    for (int task = 0; task < e->num_tasks; task++) {
+      for (int j = 0; j < bins; j++) {
+        psd[j] += e->welch_sums[(size_t)task * bins + j];
+      }
+    }
+    for (int j = 0; j < bins; j++) {
+      psd[j] /= segments;
+    }
+    double bandwidth = (e->sig->Fs / 2) / num_bands;
+    for (int band = 0; band < num_bands; band++) {
+      low[band]  = band * bandwidth + 0.0001; // same edges as the filters
+      high[band] = (band + 1) * bandwidth - 0.0001;
+    }
+    welch_band_power(e->welch_len, psd, e->sig->Fs, num_bands, low, high, band_power);
+    free(psd);
+    free(low);
+    free(high);
+  } else if (e->params.method == SETI_METHOD_CHANNELIZER) {
+    long frames = 0;
+    for (int band = 0; band < num_bands; band++) {
+      band_power[band] = 0;
+    }
+    for (int i = 0; i < e->nthreads; i++) {
+      for (int band = 0; band < num_bands; band++) {
+        band_power[band] += e->chan_sums[i * num_bands + band];
+      }
+      frames += e->chan_frames[i];
+    }
+    for (int band = 0; band < num_bands; band++) {
+      band_power[band] = frames ? band_power[band] / frames : 0;
+    }
+  } else {
+    for (int band = 0; band < num_bands; band++) {
+      int group = band / BAND_GROUP;
+      double sum = 0;
+      for (int block = 0; block < e->num_blocks; block++) {
+        sum += e->task_sums[(group * e->num_blocks + block) * BAND_GROUP + band % BAND_GROUP];
+      }
+      band_power[band] = sum / e->sig->num_samples;
+    }
+  }
+  return 0;
+}
+
+// Wakes the workers for phase and waits until all of them are done
+static void run_phase(seti_engine* e, int phase) {
+  pthread_mutex_lock(&e->lock);
+  e->phase   = phase;
+  e->pending = e->started;
+  e->generation++;
+  pthread_cond_broadcast(&e->work);
+  while (e->pending > 0) {
+    pthread_cond_wait(&e->done, &e->lock);
+  }
+  pthread_mutex_unlock(&e->lock);
+}
+
+int seti_scan(seti_engine* e, signal* sig, seti_params* params,
+              seti_results* results) {
+
+  if (!e || !sig || sig->num_samples <= 0 || !(sig->Fs > 0) ||
+      !(sig->data || sig->data_f32 || sig->data_i16) ||
+      (params && params->method != SETI_METHOD_FIR && !sig->data) ||
+      !params || params->filter_order <= 0 || (params->filter_order & 0x1) ||
+      params->num_bands <= 0 || !results || !results->band_power ||
+      (params->method != SETI_METHOD_FIR && params->method != SETI_METHOD_CHANNELIZER &&
+       params->method != SETI_METHOD_WELCH && params->method != SETI_METHOD_DDC)) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&e->scan_lock);
+
+  e->sig    = sig;
+  e->params = *params;
+  e->replicated = 0;
+  atomic_store(&e->failed, 0);
+
+  int rc = 0;
+  if (params->numa == SIGNAL_NUMA_INTERLEAVE) {
+    // best effort, the scan is still right if the pages stay put
+    interleave_signal(sig);
+  } else if (params->numa == SIGNAL_NUMA_REPLICATE && e->num_nodes > 1) {
+    if (allocate_signal_replicas(sig, e->num_nodes) == 0) {
+      run_phase(e, PHASE_REPLICATE);
+      e->replicated = 1;
+    }
+  }
+
+  if (params->method == SETI_METHOD_CHANNELIZER) {
+    e->chan_sums   = (double*)calloc((size_t)e->nthreads * params->num_bands, sizeof(double));
+    e->chan_frames = (long*)calloc(e->nthreads, sizeof(long));
+    if (!e->chan_sums || !e->chan_frames) {
+      rc = -1;
+    }
+  } else if (params->method == SETI_METHOD_WELCH) {
+    rc = prepare_welch(e);
+  } else if (params->method == SETI_METHOD_DDC) {
+    e->num_tasks = params->num_bands;
+    e->task_sums = (double*)calloc(params->num_bands, sizeof(double));
+    rc = e->task_sums ? 0 : -1;
+    atomic_store(&e->next_task, 0);
+  } else {
+    rc = prepare_fir(e);
+  }
+
+  if (rc == 0) {
+    run_phase(e, PHASE_SCAN);
+
+    if (atomic_load(&e->failed)) {
+      rc = -1;
+    } else {
+      rc = reduce(e, results->band_power);
+    }
+  }
+
+  free(e->coeffs);
+  free(e->task_sums);
+  free(e->chan_sums);
+  free(e->chan_frames);
+  free(e->welch_sums);
+  e->coeffs      = 0;
+  e->welch_sums  = 0;
+  e->task_sums   = 0;
+  e->chan_sums   = 0;
+  e->chan_frames = 0;
+  e->sig         = 0;
+
+  pthread_mutex_unlock(&e->scan_lock);
+
+  return rc;
+}
+
+
+int seti_scan_stream(seti_engine* e, char* file, double Fs, seti_params* params,
+                     seti_results* results) {
+
+  if (!e || !file || !(Fs > 0) ||
+      !params || params->filter_order <= 0 || (params->filter_order & 0x1) ||
+      params->num_bands <= 0 || !results || !results->band_power ||
+      params->method != SETI_METHOD_FIR) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&e->scan_lock);
+
+  int order     = params->filter_order;
+  int num_bands = params->num_bands;
+  e->params     = *params;
+  e->block_count = 0;
+  atomic_store(&e->failed, 0);
+
+  int rc = make_filters(e, Fs);
+  signal_stream* in = 0;
+  e->num_groups = (num_bands + BAND_GROUP - 1) / BAND_GROUP;
+  e->streams    = (fir_stream**)calloc(e->num_groups, sizeof(fir_stream*));
+  if (rc || !e->streams) {
+    rc = -1;
+  } else {
+    for (int group = 0; group < e->num_groups && rc == 0; group++) {
+      int first = group * BAND_GROUP;
+      int count = (num_bands - first < BAND_GROUP) ? num_bands - first : BAND_GROUP;
+      e->streams[group] = fir_stream_create(order, count,
+                                            (double (*)[order + 1]) &(e->coeffs[first * (order + 1)]));
+      if (!e->streams[group]) {
+        rc = -1;
+      }
+    }
+    if (rc == 0 && !(in = open_signal_stream(file, STREAM_BLOCK))) {
+      rc = -1;
+    }
+  }
+
+  // the reader fills the next block while the workers filter this one
+  while (rc == 0 && (e->block_count = read_signal_stream(in, &e->block)) > 0) {
+    atomic_store(&e->next_task, 0);
+    run_phase(e, PHASE_STREAM);
+    if (atomic_load(&e->failed)) {
+      rc = -1;
+    }
+  }
+  if (e->block_count < 0) {
+    rc = -1;
+  }
+  close_signal_stream(in);
+
+  if (rc == 0) {
+    for (int group = 0; group < e->num_groups && rc == 0; group++) {
+      rc = fir_stream_power(e->streams[group], 1, &(results->band_power[group * BAND_GROUP]));
+    }
+    results->num_samples  = fir_stream_samples(e->streams[0]);
+    results->dc           = fir_stream_mean(e->streams[0]);
+    results->signal_power = fir_stream_signal_power(e->streams[0], 1);
+  }
+
+  for (int group = 0; e->streams && group < e->num_groups; group++) {
+    fir_stream_destroy(e->streams[group]);
+  }
+  free(e->streams);
+  free(e->coeffs);
+  e->streams = 0;
+  e->coeffs  = 0;
+  e->block   = 0;
+
+  pthread_mutex_unlock(&e->scan_lock);
+
+  return rc;
+}
@@ -0,0 +1,64 @@
+#ifndef _seti_engine
+#define _seti_engine
+
+#include "signal.h"
+#include "placement.h"
+
+// Reusable band scan engine
+//
+// An engine owns a pool of worker threads that are started and pinned
+// once, in seti_engine_create(), and then run any number of scans.
+// Nothing is kept in globals, so separate engines can scan at the same
+// time. Scans on one engine are run one after another.
+
+typedef struct seti_engine_ seti_engine;
+
+// How band powers are estimated
+#define SETI_METHOD_FIR         0 // one band pass filter per band
+#define SETI_METHOD_CHANNELIZER 1 // polyphase filterbank, all bands in one pass
+#define SETI_METHOD_WELCH       2 // averaged periodograms summed over each band
+#define SETI_METHOD_DDC         3 // each band mixed down and decimated first
+
+typedef struct seti_params_ {
+  int filter_order;  // even
+  int num_bands;     // bands of equal width from 0 to Fs/2
+  int method;        // SETI_METHOD_*
+  int numa;          // SIGNAL_NUMA_*, where the workers read the samples from
+} seti_params;
+
+typedef struct seti_results_ {
+  double* band_power; // num_bands entries, supplied by the caller
+
+  // filled by seti_scan_stream() only
+  long num_samples;
+  double dc;           // mean that was removed
+  double signal_power; // average power after removing it
+} seti_results;
+
+// nthreads workers, worker i pinned where affinity places thread i
+// affinity may be NULL (no pinning); otherwise it must outlive the engine
+// Returns 0 on failure
+seti_engine* seti_engine_create(int nthreads, placement* affinity);
+
+// Fills results->band_power for sig (DC already removed, sig->Fs set)
+// Results are the same for any number of threads
+// FIR scans take any sample type, the other methods only doubles
+// With SIGNAL_NUMA_REPLICATE and workers on more than one node, the workers
+// first copy the samples into a replica on their own node (first touch)
+// and each then reads only its node's replica. The replicas are refilled
+// on every scan, since the caller may have changed sig->data in between.
+// Narrow samples are never replicated.
+// Returns 0 on success, -1 on failure
+int seti_scan(seti_engine* engine, signal* sig, seti_params* params,
+              seti_results* results);
+
+// seti_scan() of the binary signal in file, read a block at a time so the
+// signal never has to fit in memory. Reading overlaps the filtering, and
+// DC is removed with a correction at the end instead of a pass up front.
+// FIR only. Returns 0 on success, -1 on failure
+int seti_scan_stream(seti_engine* engine, char* file, double Fs,
+                     seti_params* params, seti_results* results);
+
+void seti_engine_destroy(seti_engine* engine);
+
+#endif
@@ -0,0 +1,76 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <string.h>
+
+#include "signal.h"
+
+void usage() {
+  printf("usage: sigconvert text|bin in_file out_file Fs [f64|f32|i16]\n");
+  printf("       writes in_file as a v2 binary signal with its sample rate\n");
+  printf("       f32 and i16 make the file 2 or 4 times smaller, at some precision\n");
+}
+
+int main(int argc, char* argv[]) {
+
+  if (argc != 5 && argc != 6) {
+    usage();
+    return -1;
+  }
+
+  char in_type   = toupper(argv[1][0]);
+  char* in_file  = argv[2];
+  char* out_file = argv[3];
+  double Fs      = atof(argv[4]);
+  int type       = SIGNAL_SAMPLE_F64;
+
+  if (argc == 6) {
+    if (!strcmp(argv[5], "f32")) {
+      type = SIGNAL_SAMPLE_F32;
+    } else if (!strcmp(argv[5], "i16")) {
+      type = SIGNAL_SAMPLE_I16;
+    } else if (strcmp(argv[5], "f64")) {
+      usage();
+      return -1;
+    }
+  }
+
+  // converting works on doubles
+  set_signal_native_samples(0);
+
+  signal* sig;
+  switch (in_type) {
+    case 'T':
+      sig = load_text_format_signal(in_file);
+      break;
+
+    case 'B':
+      sig = load_binary_format_signal(in_file);
+      break;
+
+    default:
+      usage();
+      return -1;
+  }
+
+  if (!sig) {
+    printf("Unable to load file\n");
+    return -1;
+  }
+
+  // keep the rate of a v2 input unless told otherwise
+  if (Fs > 0.0) {
+    sig->Fs = Fs;
+  }
+  if (sig->Fs <= 0.0) {
+    printf("No sample rate given and none in the file\n");
+    free_signal(sig);
+    return -1;
+  }
+
+  int rc = save_v2_format_signal(out_file, sig, type);
+
+  free_signal(sig);
+
+  return rc;
+}
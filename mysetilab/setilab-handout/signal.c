@@ -1,27 +1,139 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include "signal.h"
 
+static void free_signal_replicas(signal* sig);
+
+static int hugepages = SIGNAL_HUGEPAGES_THP;
+
+void set_signal_hugepages(int mode) {
+  hugepages = mode;
+}
+
+#define HUGE_2MB (1UL << 21)
+#define HUGE_1GB (1UL << 30)
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+static int native_samples = 1;
+
+void set_signal_native_samples(int keep) {
+  native_samples = keep;
+}
+
+static size_t sample_bytes(int sample_type);
+
+// Anonymous mapping of len bytes, on huge pages if so configured.
+// No pages are touched here. *bytes gets the size to munmap() later.
+// Returns 0 on failure
+static void* map_sample_bytes(size_t len, size_t* bytes) {
+
+  // mmap() refuses a zero length, so an empty signal still gets a page
+  if (len == 0) {
+    len = sizeof(double);
+  }
+  void* p = MAP_FAILED;
+
+  if (hugepages == SIGNAL_HUGEPAGES_2MB || hugepages == SIGNAL_HUGEPAGES_1GB) {
+    int shift   = hugepages == SIGNAL_HUGEPAGES_1GB ? 30 : 21;
+    size_t huge = hugepages == SIGNAL_HUGEPAGES_1GB ? HUGE_1GB : HUGE_2MB;
+    *bytes = (len + huge - 1) & ~(huge - 1);
+    p = mmap(0, *bytes, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT),
+             -1, 0);
+  }
+
+  // no reserved huge pages (or not asked for them): ordinary pages, which
+  // the kernel may still back with transparent huge pages
+  if (p == MAP_FAILED) {
+    *bytes = len;
+    p = mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      return 0;
+    }
+    if (hugepages != SIGNAL_HUGEPAGES_NONE) {
+      madvise(p, len, MADV_HUGEPAGE);
+    }
+  }
+
+  return p;
+}
+
+// The same for num doubles
+static double* map_samples(long num, size_t* bytes) {
+  return (double*)map_sample_bytes(sizeof(double) * (size_t)num, bytes);
+}
+
+// Whichever of data, data_f32 and data_i16 holds the samples
+static void* sample_buffer(signal* sig) {
+  switch (sig->sample_type) {
+    case SIGNAL_SAMPLE_F32: return sig->data_f32;
+    case SIGNAL_SAMPLE_I16: return sig->data_i16;
+    default:                return sig->data;
+  }
+}
+
+static void set_sample_buffer(signal* sig, int sample_type, void* buffer) {
+  sig->sample_type = sample_type;
+  sig->data     = sample_type == SIGNAL_SAMPLE_F64 ? (double*)buffer : 0;
+  sig->data_f32 = sample_type == SIGNAL_SAMPLE_F32 ? (float*)buffer : 0;
+  sig->data_i16 = sample_type == SIGNAL_SAMPLE_I16 ? (int16_t*)buffer : 0;
+}
+
+// Sample memory of sig->sample_type for sig->num_samples
+static int allocate_samples(signal* sig, int sample_type) {
+  size_t len = sample_bytes(sample_type) * sig->num_samples;
+  void* buffer;
+  sig->data_bytes = 0;
+  if (hugepages == SIGNAL_HUGEPAGES_NONE) {
+    buffer = malloc(len);
+  } else {
+    buffer = map_sample_bytes(len, &(sig->data_bytes));
+  }
+  if (!buffer) {
+    perror("Not enough memory");
+    return -1;
+  }
+  set_sample_buffer(sig, sample_type, buffer);
+  return 0;
+}
+
+// Releases the samples, however they were allocated or mapped
+static void free_samples(signal* sig) {
+  void* buffer = sample_buffer(sig);
+  if (buffer) {
+    if (sig->map_fd >= 0) {
+      unmap_binary_format_signal(sig);
+    } else if (sig->data_bytes) {
+      munmap(buffer, sig->data_bytes);
+    } else {
+      free(buffer);
+    }
+  }
+  set_sample_buffer(sig, sig->sample_type, 0);
+}
 
 void free_signal(signal* sig) {
   if (sig) {
-    if (sig->data) {
-      if (sig->map_fd >= 0) {
-        unmap_binary_format_signal(sig);
-      } else {
-        free(sig->data);
-      }
-    }
+    free_signal_replicas(sig);
+    free(sig->info);
+    free_samples(sig);
     free(sig);
   }
 }
 
-signal* allocate_signal(int numsamples, double Fs, int for_mapping) {
+signal* allocate_signal(long numsamples, double Fs, int for_mapping) {
 
   signal* sig;
   if (!(sig = (signal*)malloc(sizeof(signal)))) {
@@ -33,10 +145,16 @@ signal* allocate_signal(int numsamples, double Fs, int for_mapping) {
   sig->Fs     = Fs;
   sig->data   = 0;
   sig->map_fd = -1;
+  sig->data_bytes   = 0;
+  sig->num_replicas = 0;
+  sig->replicas     = 0;
+  sig->info         = 0;
+  sig->scale        = 1;
+  sig->offset       = 0;
+  set_sample_buffer(sig, SIGNAL_SAMPLE_F64, 0);
 
   if (!for_mapping) {
-    if (!(sig->data = (double*)malloc(sizeof(double) * sig->num_samples))) {
-      perror("Not enough memory");
+    if (allocate_samples(sig, SIGNAL_SAMPLE_F64)) {
       free_signal(sig);
       return 0;
     }
@@ -45,44 +163,349 @@ signal* allocate_signal(int numsamples, double Fs, int for_mapping) {
   return sig;
 }
 
+
+int widen_signal(signal* sig) {
+
+  if (sig->sample_type == SIGNAL_SAMPLE_F64) {
+    return 0;
+  }
+
+  signal wide = *sig;
+  wide.map_fd = -1;
+  if (allocate_samples(&wide, SIGNAL_SAMPLE_F64)) {
+    return -1;
+  }
+  for (long i = 0; i < sig->num_samples; i++) {
+    wide.data[i] = sig->sample_type == SIGNAL_SAMPLE_F32 ?
+                   sig->data_f32[i] - sig->offset :
+                   sig->scale * sig->data_i16[i] - sig->offset;
+  }
+
+  free_samples(sig);
+  set_sample_buffer(sig, SIGNAL_SAMPLE_F64, wide.data);
+  sig->data_bytes = wide.data_bytes;
+  sig->scale      = 1;
+  sig->offset     = 0;
+  return 0;
+}
+
+
+// value of sample i, whatever the type
+static inline double sample_value(signal* sig, long i) {
+  switch (sig->sample_type) {
+    case SIGNAL_SAMPLE_F32: return sig->data_f32[i] - sig->offset;
+    case SIGNAL_SAMPLE_I16: return sig->scale * sig->data_i16[i] - sig->offset;
+    default:                return sig->data[i] - sig->offset;
+  }
+}
+
+int signal_stats(signal* sig, double* mean, double* power) {
+  if (sig->num_samples <= 0) {
+    return -1;
+  }
+  double sum = 0;
+  double sum_squares = 0;
+  for (long i = 0; i < sig->num_samples; i++) {
+    double v = sample_value(sig, i);
+    sum         += v;
+    sum_squares += v * v;
+  }
+  *mean  = sum / sig->num_samples;
+  *power = sum_squares / sig->num_samples - *mean * *mean;
+  return 0;
+}
+
+void remove_signal_dc(signal* sig, double dc) {
+  switch (sig->sample_type) {
+    case SIGNAL_SAMPLE_F32:
+      for (long i = 0; i < sig->num_samples; i++) {
+        sig->data_f32[i] -= dc;
+      }
+      break;
+    case SIGNAL_SAMPLE_I16:
+      // can't come off 16-bit integers, the kernels take it off
+      sig->offset += dc;
+      break;
+    default:
+      for (long i = 0; i < sig->num_samples; i++) {
+        sig->data[i] -= dc;
+      }
+  }
+}
+
+// Text loading
+// The file is mapped and cut into one chunk per thread at whitespace, so
+// no number straddles two chunks. Each thread counts its numbers, a prefix
+// sum of the counts says where each chunk's samples go, and then each
+// thread parses its chunk straight into place.
+
+#define TEXT_CHUNK_MIN (1 << 20) // bytes, smaller files aren't worth a thread
+#define TEXT_MAX_THREADS 64
+#define MAX_FAST_DIGITS 19       // fit in a uint64_t
+
+static int is_space(char c) {
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// 10^0 .. 10^22 are exact doubles
+static const double exact_powers_of_ten[] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Parses the number in [p, end) (one whitespace delimited token) into *v.
+// Returns the number of characters used, 0 if there is no number.
+//
+// Decimal numbers with at most 19 significant digits whose value is an
+// integer below 2^53 times or divided by an exact power of ten are done
+// directly (Clinger's fast path): both operands are exact, so the one
+// rounding in the multiply or divide gives the correctly rounded result.
+// Everything else (long mantissas, big exponents, inf, nan, hex) goes to
+// strtod(), which is also correctly rounded.
+static long parse_double(const char* p, const char* end, double* v) {
+
+  const char* start = p;
+  int negative = 0;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    p++;
+  }
+
+  unsigned long long mantissa = 0;
+  int digits = 0;     // significant digits in mantissa
+  int any = 0;        // saw at least one digit
+  int exponent = 0;
+
+  while (p < end && *p == '0') {
+    any = 1;
+    p++;
+  }
+  while (p < end && *p >= '0' && *p <= '9') {
+    mantissa = mantissa * 10 + (*p - '0');
+    digits++;
+    any = 1;
+    p++;
+  }
+  if (p < end && *p == '.') {
+    p++;
+    if (!digits) {
+      while (p < end && *p == '0') {
+        exponent--;
+        any = 1;
+        p++;
+      }
+    }
+    while (p < end && *p >= '0' && *p <= '9') {
+      mantissa = mantissa * 10 + (*p - '0');
+      digits++;
+      exponent--;
+      any = 1;
+      p++;
+    }
+  }
+  if (any && p < end && (*p == 'e' || *p == 'E')) {
+    const char* q = p + 1;
+    int exp_negative = 0;
+    if (q < end && (*q == '-' || *q == '+')) {
+      exp_negative = *q == '-';
+      q++;
+    }
+    if (q < end && *q >= '0' && *q <= '9') {
+      int e = 0;
+      while (q < end && *q >= '0' && *q <= '9') {
+        if (e < 100000) {
+          e = e * 10 + (*q - '0');
+        }
+        q++;
+      }
+      exponent += exp_negative ? -e : e;
+      p = q;
+    }
+  }
+
+  if (any && (p == end || is_space(*p)) && digits <= MAX_FAST_DIGITS &&
+      mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+    double d = (double)mantissa;
+    d = exponent < 0 ? d / exact_powers_of_ten[-exponent] : d * exact_powers_of_ten[exponent];
+    *v = negative ? -d : d;
+    return p - start;
+  }
+
+  // slow path on a terminated copy, the mapping has no terminator
+  char buf[512];
+  const char* tok_end = start;
+  while (tok_end < end && !is_space(*tok_end)) {
+    tok_end++;
+  }
+  long len = tok_end - start;
+  if (len >= (long)sizeof(buf)) {
+    len = sizeof(buf) - 1;
+  }
+  memcpy(buf, start, len);
+  buf[len] = 0;
+
+  char* used;
+  *v = strtod(buf, &used);
+  return used - buf;
+}
+
+typedef struct text_chunk_ {
+  const char* begin;
+  const char* end;
+  long count;     // numbers in the chunk
+  long first;     // index of its first sample
+  long parsed;    // numbers parsed before a bad token (count if none)
+  double* data;
+} text_chunk;
+
+static void* count_text_chunk(void* arg) {
+  text_chunk* c = (text_chunk*)arg;
+  long count = 0;
+  int in_token = 0;
+  for (const char* p = c->begin; p < c->end; p++) {
+    int space = is_space(*p);
+    count += !space && !in_token;
+    in_token = !space;
+  }
+  c->count = count;
+  return NULL;
+}
+
+static void* parse_text_chunk(void* arg) {
+  text_chunk* c = (text_chunk*)arg;
+  const char* p = c->begin;
+  long n = 0;
+  while (n < c->count) {
+    while (p < c->end && is_space(*p)) {
+      p++;
+    }
+    long used = parse_double(p, c->end, &(c->data[c->first + n]));
+    if (used == 0) {
+      break;
+    }
+    n++;
+    p += used;
+    if (p < c->end && !is_space(*p)) {
+      break; // junk right after a number, fscanf("%lf") would stop here too
+    }
+  }
+  c->parsed = n;
+  return NULL;
+}
+
+// Runs fn on every chunk, each but the first on its own thread
+static void run_text_chunks(text_chunk chunks[], int n, void* (*fn)(void*)) {
+  pthread_t tids[TEXT_MAX_THREADS];
+  int started[TEXT_MAX_THREADS];
+  for (int i = 1; i < n; i++) {
+    started[i] = pthread_create(&tids[i], NULL, fn, &chunks[i]) == 0;
+    if (!started[i]) {
+      fn(&chunks[i]);
+    }
+  }
+  fn(&chunks[0]);
+  for (int i = 1; i < n; i++) {
+    if (started[i]) {
+      pthread_join(tids[i], NULL);
+    }
+  }
+}
+
 signal* load_text_format_signal(char* file) {
 
-  FILE* f;
-  if (!(f = fopen(file, "r"))) {
+  int fd;
+  if ((fd = open(file, O_RDONLY)) < 0) {
     perror("Cannot open file");
     return 0;
   }
 
-  double junk;
-  int num = 0;
-  while (fscanf(f, "%lf", &junk) == 1) {
-    num++;
+  struct stat st;
+  if (fstat(fd, &st)) {
+    perror("cannot stat file");
+    close(fd);
+    return 0;
+  }
+  size_t size = st.st_size;
+
+  const char* text = 0;
+  if (size > 0) {
+    text = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (text == MAP_FAILED) {
+      perror("Cannot mmap");
+      close(fd);
+      return 0;
+    }
+    madvise((void*)text, size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+
+  // cut at whitespace
+  long procs = sysconf(_SC_NPROCESSORS_ONLN);
+  int n = (int)(size / TEXT_CHUNK_MIN);
+  if (n > procs) {
+    n = (int)procs;
+  }
+  if (n > TEXT_MAX_THREADS) {
+    n = TEXT_MAX_THREADS;
+  }
+  if (n < 1) {
+    n = 1;
+  }
+
+  text_chunk chunks[TEXT_MAX_THREADS];
+  const char* cur = text;
+  for (int i = 0; i < n; i++) {
+    const char* stop = text + size * (i + 1) / n;
+    while (stop < text + size && !is_space(*stop)) {
+      stop++;
+    }
+    if (stop < cur) {
+      stop = cur;
+    }
+    chunks[i].begin = cur;
+    chunks[i].end   = stop;
+    cur = stop;
+  }
+
+  run_text_chunks(chunks, n, count_text_chunk);
+
+  long num = 0;
+  for (int i = 0; i < n; i++) {
+    chunks[i].first = num;
+    num += chunks[i].count;
   }
 
-  printf("Found %d samples\n", num);
+  printf("Found %ld samples\n", num);
 
   signal* sig = allocate_signal(num, 0, 0);
 
   if (!sig) {
-    fclose(f);
+    if (text) {
+      munmap((void*)text, size);
+    }
     return 0;
   }
 
-  rewind(f);
+  for (int i = 0; i < n; i++) {
+    chunks[i].data = sig->data;
+  }
+  run_text_chunks(chunks, n, parse_text_chunk);
 
-  for (num = 0;
-       num < sig->num_samples;
-       num++) {
-    if (fscanf(f,"%lf",&(sig->data[num])) != 1) {
-      perror("Unable to read sample\n");
-      free_signal(sig);
-      return 0;
-    }
+  if (text) {
+    munmap((void*)text, size);
   }
 
-  fclose(f);
+  // everything up to the first thing that isn't a number
+  num = 0;
+  for (int i = 0; i < n; i++) {
+    num += chunks[i].parsed;
+    if (chunks[i].parsed < chunks[i].count) {
+      break;
+    }
+  }
+  sig->num_samples = num;
 
-  printf("Read %d samples\n", num);
+  printf("Read %ld samples\n", num);
 
   return sig;
 }
@@ -90,13 +513,18 @@ signal* load_text_format_signal(char* file) {
 
 int save_text_format_signal(char* file, signal* sig) {
 
+  if (sig->sample_type != SIGNAL_SAMPLE_F64) {
+    printf("Only double samples can be saved, widen_signal() first\n");
+    return -1;
+  }
+
   FILE* f;
   if (!(f = fopen(file,"w"))) {
     perror("Cannot open file");
     return -1;
   }
 
-  for (int i = 0; i < sig->num_samples; i++) {
+  for (long i = 0; i < sig->num_samples; i++) {
     fprintf(f,"%lf\n",sig->data[i]);
   }
 
@@ -107,52 +535,234 @@ int save_text_format_signal(char* file, signal* sig) {
 }
 
 
-#define OFFSET_TO_DATA 0
+#define OFFSET_TO_DATA 0 // raw files
+
+// v2 header as it is on disk (little endian), zero padded to
+// SIGNAL_HEADER_BYTES
+typedef struct v2_header_ {
+  char magic[8];
+  uint32_t version;
+  uint32_t sample_type;
+  double Fs;
+  double scale;
+  uint64_t num_samples;
+  uint64_t chunk_samples;
+  uint32_t num_chunks;
+  uint32_t reserved;
+  uint64_t data_checksum;
+  uint64_t header_checksum; // of the padded header with this field 0
+  signal_chunk chunks[SIGNAL_MAX_CHUNKS];
+} v2_header;
+
+_Static_assert(sizeof(v2_header) <= SIGNAL_HEADER_BYTES, "v2 header too big");
+
+// A v2 header with the zero padding that makes up a whole on-disk header
+typedef union {
+  v2_header h;
+  char page[SIGNAL_HEADER_BYTES];
+} v2_header_page;
+
+#define CHECKSUM_START 0xcbf29ce484222325ULL
+#define CHECKSUM_PRIME 0x100000001b3ULL
+
+// FNV-1a over 8 byte words, then the leftover bytes
+// Continue a checksum by passing the previous result as h (bytes must be
+// a multiple of 8 except in the last call)
+static uint64_t checksum_bytes(uint64_t h, const void* data, size_t bytes) {
+  const char* p = (const char*)data;
+  size_t words  = bytes / 8;
+  for (size_t i = 0; i < words; i++) {
+    uint64_t w;
+    memcpy(&w, p + 8 * i, 8);
+    h = (h ^ w) * CHECKSUM_PRIME;
+  }
+  for (size_t i = 8 * words; i < bytes; i++) {
+    h = (h ^ (unsigned char)p[i]) * CHECKSUM_PRIME;
+  }
+  return h;
+}
 
-int get_num_samples_from_binary_file(char* file, int map) {
+static uint64_t header_checksum(const char page[SIGNAL_HEADER_BYTES]) {
+  char copy[SIGNAL_HEADER_BYTES];
+  memcpy(copy, page, SIGNAL_HEADER_BYTES);
+  memset(copy + offsetof(v2_header, header_checksum), 0, sizeof(uint64_t));
+  return checksum_bytes(CHECKSUM_START, copy, SIGNAL_HEADER_BYTES);
+}
 
-  struct stat s;
-  if (lstat(file, &s)) {
-    perror("cannot stat file");
-    return 0;
+static size_t sample_bytes(int sample_type) {
+  switch (sample_type) {
+    case SIGNAL_SAMPLE_F32: return sizeof(float);
+    case SIGNAL_SAMPLE_I16: return sizeof(int16_t);
+    default:                return sizeof(double);
   }
+}
 
-  return (s.st_size - OFFSET_TO_DATA) / sizeof(double);
+// The num stored samples are packed at the end of data's num doubles.
+// Widens them in place. Going front to back never overwrites a stored
+// sample before it is read, because a double is at least as wide.
+static void widen_samples(double* data, long num, int sample_type, double scale) {
+  char* stored = (char*)data + (sizeof(double) - sample_bytes(sample_type)) * num;
+  if (sample_type == SIGNAL_SAMPLE_F32) {
+    for (long i = 0; i < num; i++) {
+      float v;
+      memcpy(&v, stored + sizeof(float) * i, sizeof(float));
+      data[i] = v;
+    }
+  } else if (sample_type == SIGNAL_SAMPLE_I16) {
+    for (long i = 0; i < num; i++) {
+      int16_t v;
+      memcpy(&v, stored + sizeof(int16_t) * i, sizeof(int16_t));
+      data[i] = scale * v;
+    }
+  }
 }
 
+// Reads the header of the open file fd and checks the file is long enough
+static int read_info_fd(int fd, char* file, signal_info* info) {
 
-signal* load_binary_format_signal(char* file) {
+  struct stat st;
+  if (fstat(fd, &st)) {
+    perror("cannot stat file");
+    return -1;
+  }
 
-  int num = get_num_samples_from_binary_file(file, 0);
+  char page[SIGNAL_HEADER_BYTES];
+  ssize_t got = pread(fd, page, SIGNAL_HEADER_BYTES, 0);
 
-  if (num <= 0) {
+  memset(info, 0, sizeof(signal_info));
+  info->sample_type = SIGNAL_SAMPLE_F64;
+  info->scale       = 1;
+
+  if (got < (ssize_t)sizeof(SIGNAL_MAGIC) || memcmp(page, SIGNAL_MAGIC, sizeof(SIGNAL_MAGIC))) {
+    info->version     = 1;
+    info->data_offset = OFFSET_TO_DATA;
+    info->num_samples = (st.st_size - OFFSET_TO_DATA) / sizeof(double);
+    if ((st.st_size - OFFSET_TO_DATA) % sizeof(double)) {
+      printf("%s: ignoring a partial sample at the end\n", file);
+    }
     return 0;
   }
 
+  v2_header h;
+  memcpy(&h, page, sizeof(h));
+  if (got != SIGNAL_HEADER_BYTES || h.header_checksum != header_checksum(page)) {
+    printf("%s: corrupt signal header\n", file);
+    return -1;
+  }
+  if (h.version != 2 || h.sample_type > SIGNAL_SAMPLE_I16 ||
+      h.num_chunks > SIGNAL_MAX_CHUNKS) {
+    printf("%s: unsupported signal format version %u type %u\n", file, h.version, h.sample_type);
+    return -1;
+  }
+
+  info->version       = 2;
+  info->sample_type   = h.sample_type;
+  info->Fs            = h.Fs;
+  info->scale         = h.scale;
+  info->num_samples   = h.num_samples;
+  info->data_offset   = SIGNAL_HEADER_BYTES;
+  info->checksum      = h.data_checksum;
+  info->chunk_samples = h.chunk_samples;
+  info->num_chunks    = h.num_chunks;
+  memcpy(info->chunks, h.chunks, sizeof(signal_chunk) * h.num_chunks);
+
+  long want = info->data_offset + info->num_samples * sample_bytes(info->sample_type);
+  if (st.st_size < want) {
+    printf("%s: truncated, %ld of %ld bytes\n", file, (long)st.st_size, want);
+    return -1;
+  }
+  return 0;
+}
+
+int read_signal_info(char* file, signal_info* info) {
   int fd;
   if ((fd = open(file, O_RDONLY)) < 0) {
     perror("Cannot open file");
+    return -1;
+  }
+  int rc = read_info_fd(fd, file, info);
+  close(fd);
+  return rc;
+}
+
+// Keeps a copy of a v2 header with the signal
+static int attach_info(signal* sig, signal_info* info) {
+  sig->Fs = info->Fs;
+  if (info->version < 2) {
     return 0;
   }
+  if (!(sig->info = (signal_info*)malloc(sizeof(signal_info)))) {
+    perror("Not enough memory");
+    return -1;
+  }
+  *sig->info = *info;
+  return 0;
+}
 
-  signal* sig = allocate_signal(num, 0, 0);
+int signal_summary_stats(signal* sig, double* mean, double* power) {
+  signal_info* info = sig->info;
+  if (!info || info->num_chunks == 0 || sig->num_samples == 0) {
+    return -1;
+  }
+  double sum = 0;
+  double sum_squares = 0;
+  for (int c = 0; c < info->num_chunks; c++) {
+    sum         += info->chunks[c].sum;
+    sum_squares += info->chunks[c].sum_squares;
+  }
+  *mean  = sum / sig->num_samples;
+  *power = sum_squares / sig->num_samples - *mean * *mean;
+  return 0;
+}
 
-  if (!sig) {
+
+signal* load_binary_format_signal(char* file) {
+
+  int fd;
+  if ((fd = open(file, O_RDONLY)) < 0) {
+    perror("Cannot open file");
+    return 0;
+  }
+
+  signal_info info;
+  if (read_info_fd(fd, file, &info)) {
     close(fd);
     return 0;
   }
+  long num = info.num_samples;
 
-  lseek(fd,OFFSET_TO_DATA,SEEK_SET);
+  if (num <= 0) {
+    close(fd);
+    return 0;
+  }
+
+  // narrower samples are kept as they are, or read into the end of a
+  // buffer of doubles and widened
+  int keep = native_samples && info.sample_type != SIGNAL_SAMPLE_F64;
+  signal* sig = allocate_signal(num, 0, keep);
+
+  if (!sig || attach_info(sig, &info) || (keep && allocate_samples(sig, info.sample_type))) {
+    free_signal(sig);
+    close(fd);
+    return 0;
+  }
+  sig->scale = info.scale;
 
-  int left  = num * sizeof(double); // number of bytes left to read
-  char* cur = (char*)(sig->data);  // location of next read
-  int thisread;
+  lseek(fd,info.data_offset,SEEK_SET);
+
+  size_t bytes = num * sample_bytes(info.sample_type);
+  size_t left = bytes; // number of bytes left to read
+  char* cur   = keep ? (char*)sample_buffer(sig) :
+                (char*)(sig->data) + (num * sizeof(double) - bytes);  // location of next read
+  char* stored = cur;
+  ssize_t thisread;
 
   while (left > 0) {
     thisread = read(fd, cur, left);
     if (thisread <= 0) {
       perror("Read failure");
       free_signal(sig);
+      close(fd);
       return 0;
     }
     cur  += thisread;
@@ -161,7 +771,17 @@ signal* load_binary_format_signal(char* file) {
 
   close(fd);
 
-  printf("Read %d samples\n", num);
+  if (info.version >= 2 && checksum_bytes(CHECKSUM_START, stored, bytes) != info.checksum) {
+    printf("%s: data checksum mismatch\n", file);
+    free_signal(sig);
+    return 0;
+  }
+  if (!keep) {
+    widen_samples(sig->data, num, info.sample_type, info.scale);
+    sig->scale = 1;
+  }
+
+  printf("Read %ld samples\n", num);
 
   return sig;
 }
@@ -169,6 +789,11 @@ signal* load_binary_format_signal(char* file) {
 
 int save_binary_format_signal(char* file, signal* sig) {
 
+  if (sig->sample_type != SIGNAL_SAMPLE_F64) {
+    printf("Only double samples can be saved, widen_signal() first\n");
+    return -1;
+  }
+
   int fd;
   if ((fd = open(file,O_WRONLY | O_CREAT,0x644)) < 0) {
     perror("Cannot open file");
@@ -177,9 +802,9 @@ int save_binary_format_signal(char* file, signal* sig) {
 
   lseek(fd,OFFSET_TO_DATA,SEEK_SET);
 
-  int left  = sig->num_samples * sizeof(double); // number of bytes left to read
-  char* cur = (char*)(sig->data);  // location of next read
-  int thiswrite;
+  size_t left = sig->num_samples * sizeof(double); // number of bytes left to read
+  char* cur   = (char*)(sig->data);  // location of next read
+  ssize_t thiswrite;
 
   while (left > 0) {
     thiswrite = write(fd,cur,left);
@@ -193,50 +818,201 @@ int save_binary_format_signal(char* file, signal* sig) {
 
   close(fd);
 
-  printf("Wrote %d samples\n", sig->num_samples);
+  printf("Wrote %ld samples\n", sig->num_samples);
 
   return 0;
 }
 
 
+#define SAVE_BLOCK 65536 // samples converted per write
 
-signal* map_binary_format_signal(char* file) {
+static int write_all(int fd, const char* cur, size_t left) {
+  while (left > 0) {
+    ssize_t thiswrite = write(fd, cur, left);
+    if (thiswrite <= 0) {
+      perror("Write failure");
+      return -1;
+    }
+    cur  += thiswrite;
+    left -= thiswrite;
+  }
+  return 0;
+}
 
-  int num = get_num_samples_from_binary_file(file, 1);
-  if (num <= 0) {
-    return 0;
+int save_v2_format_signal(char* file, signal* sig, int sample_type) {
+
+  if (sample_type < SIGNAL_SAMPLE_F64 || sample_type > SIGNAL_SAMPLE_I16) {
+    printf("Unknown sample type %d\n", sample_type);
+    return -1;
+  }
+  if (sig->sample_type != SIGNAL_SAMPLE_F64) {
+    printf("Only double samples can be saved, widen_signal() first\n");
+    return -1;
+  }
+
+  int fd;
+  if ((fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    perror("Cannot open file");
+    return -1;
+  }
+
+  long num = sig->num_samples;
+
+  // int16 covers the largest magnitude
+  double scale = 1;
+  if (sample_type == SIGNAL_SAMPLE_I16) {
+    double peak = 0;
+    for (long i = 0; i < num; i++) {
+      double a = sig->data[i] < 0 ? -sig->data[i] : sig->data[i];
+      peak = a > peak ? a : peak;
+    }
+    if (peak > 0) {
+      scale = peak / INT16_MAX;
+    }
   }
 
+  v2_header_page header;
+  memset(&header, 0, sizeof(header));
+  v2_header* h = &header.h;
+  memcpy(h->magic, SIGNAL_MAGIC, sizeof(SIGNAL_MAGIC));
+  h->version       = 2;
+  h->sample_type   = sample_type;
+  h->Fs            = sig->Fs;
+  h->scale         = scale;
+  h->num_samples   = num;
+  h->chunk_samples = (num + SIGNAL_MAX_CHUNKS - 1) / SIGNAL_MAX_CHUNKS;
+  h->num_chunks    = h->chunk_samples ? (num + h->chunk_samples - 1) / h->chunk_samples : 0;
+
+  // header last, once the checksum and summaries are known
+  if (lseek(fd, SIGNAL_HEADER_BYTES, SEEK_SET) < 0) {
+    perror("Cannot seek");
+    close(fd);
+    return -1;
+  }
+
+  char* buf = (char*)malloc(SAVE_BLOCK * sizeof(double));
+  if (!buf) {
+    perror("Not enough memory");
+    close(fd);
+    return -1;
+  }
+  uint64_t sum = CHECKSUM_START;
+  for (long first = 0; first < num; first += SAVE_BLOCK) {
+    long count = num - first < SAVE_BLOCK ? num - first : SAVE_BLOCK;
+    for (long i = 0; i < count; i++) {
+      double v = sig->data[first + i];
+      if (sample_type == SIGNAL_SAMPLE_F32) {
+        float f = (float)v;
+        memcpy(buf + sizeof(float) * i, &f, sizeof(float));
+        v = f;
+      } else if (sample_type == SIGNAL_SAMPLE_I16) {
+        double q = v / scale;
+        int16_t s = (int16_t)(q < 0 ? q - 0.5 : q + 0.5);
+        memcpy(buf + sizeof(int16_t) * i, &s, sizeof(int16_t));
+        v = scale * s;
+      } else {
+        memcpy(buf + sizeof(double) * i, &v, sizeof(double));
+      }
+
+      // summaries of the values a reader will get back, so min and max
+      // start from a chunk's first converted value
+      signal_chunk* c = &(h->chunks[(first + i) / h->chunk_samples]);
+      if ((first + i) % h->chunk_samples == 0) {
+        c->min = v;
+        c->max = v;
+      }
+      c->min = v < c->min ? v : c->min;
+      c->max = v > c->max ? v : c->max;
+      c->sum         += v;
+      c->sum_squares += v * v;
+    }
+    size_t bytes = count * sample_bytes(sample_type);
+    sum = checksum_bytes(sum, buf, bytes);
+    if (write_all(fd, buf, bytes)) {
+      free(buf);
+      close(fd);
+      return -1;
+    }
+  }
+  free(buf);
+
+  h->data_checksum   = sum;
+  h->header_checksum = header_checksum(header.page);
+  if (pwrite(fd, header.page, SIGNAL_HEADER_BYTES, 0) != SIGNAL_HEADER_BYTES) {
+    perror("Write failure");
+    close(fd);
+    return -1;
+  }
+
+  close(fd);
+
+  printf("Wrote %ld samples\n", num);
+
+  return 0;
+}
+
+
+signal* map_binary_format_signal(char* file) {
+
   int fd;
   if ((fd = open(file, O_RDWR)) < 0) {
     perror("Cannot open file");
     return 0;
   }
 
+  signal_info info;
+  if (read_info_fd(fd, file, &info)) {
+    close(fd);
+    return 0;
+  }
+  long num = info.num_samples;
+
+  if (num <= 0) {
+    close(fd);
+    return 0;
+  }
+  if (info.sample_type != SIGNAL_SAMPLE_F64 && !native_samples) {
+    printf("%s: can't map narrow samples as doubles, load it instead\n", file);
+    close(fd);
+    return 0;
+  }
+
   // no space allocated here
   signal* sig = allocate_signal(num, 0, 1);
 
-  if (!sig) {
+  if (!sig || attach_info(sig, &info)) {
+    free_signal(sig);
     close(fd);
     return 0;
   }
+  sig->scale = info.scale;
 
-  sig->data = mmap(0,                  // map anywhere
-                   num * sizeof(double), // this number of bytes
+  size_t bytes = num * sample_bytes(info.sample_type);
+  void* data = mmap(0,                  // map anywhere
+                   bytes, // this number of bytes
                    PROT_READ | PROT_WRITE, // Read/Write
-                   MAP_SHARED, // flush writes to file
+                   // flush writes to a raw file; keep them private for v2
+                   // so the data still matches the checksum
+                   info.version >= 2 ? MAP_PRIVATE : MAP_SHARED,
                    fd, // this file
-                   OFFSET_TO_DATA);
+                   info.data_offset); // page aligned
 
-  if (sig->data == MAP_FAILED) {
+  if (data == MAP_FAILED) {
     perror("Cannot mmap");
-    sig->data = 0;
     free_signal(sig);
+    close(fd);
     return 0;
   }
 
+  set_sample_buffer(sig, info.sample_type, data);
   sig->map_fd = fd; // to close later
 
+  // file pages can only be huge where the filesystem supports it, so
+  // this is a hint
+  if (hugepages != SIGNAL_HUGEPAGES_NONE) {
+    madvise(data, bytes, MADV_HUGEPAGE);
+  }
+
   return sig;
 }
 
@@ -247,11 +1023,270 @@ int unmap_binary_format_signal(signal* sig) {
     return -1;
   }
 
-  munmap(sig->data, sig->num_samples * sizeof(double));
-  sig->data = 0;
+  munmap(sample_buffer(sig), sig->num_samples * sample_bytes(sig->sample_type));
+  set_sample_buffer(sig, sig->sample_type, 0);
   close(sig->map_fd);
   sig->map_fd = -1;
 
   return 0;
 }
 
+
+// mbind() without needing libnuma's numaif.h
+#define MPOL_INTERLEAVE_ 3
+#define MPOL_MF_MOVE_    (1 << 1)
+#define MAX_NODES        1024
+
+int interleave_signal(signal* sig) {
+
+  unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))];
+  memset(mask, 0, sizeof(mask));
+
+  DIR* d = opendir("/sys/devices/system/node");
+  if (!d) {
+    return -1;
+  }
+  struct dirent* ent;
+  int id;
+  while ((ent = readdir(d))) {
+    if (sscanf(ent->d_name, "node%d", &id) == 1 && id >= 0 && id < MAX_NODES) {
+      mask[id / (8 * sizeof(unsigned long))] |= 1UL << (id % (8 * sizeof(unsigned long)));
+    }
+  }
+  closedir(d);
+
+  // mbind works on whole pages
+  long page    = sysconf(_SC_PAGESIZE);
+  char* data   = (char*)sample_buffer(sig);
+  char* start  = (char*)((unsigned long)data & ~(page - 1));
+  char* end    = data + sig->num_samples * sample_bytes(sig->sample_type);
+  if (syscall(SYS_mbind, start, (unsigned long)(end - start), MPOL_INTERLEAVE_,
+              mask, (unsigned long)MAX_NODES, MPOL_MF_MOVE_)) {
+    perror("Cannot interleave signal");
+    return -1;
+  }
+  return 0;
+}
+
+
+int allocate_signal_replicas(signal* sig, int num_nodes) {
+
+  if (sig->sample_type != SIGNAL_SAMPLE_F64) {
+    return -1;
+  }
+  if (sig->num_replicas == num_nodes) {
+    return 0;
+  }
+  free_signal_replicas(sig);
+
+  if (!(sig->replicas = (double**)calloc(num_nodes, sizeof(double*)))) {
+    perror("Not enough memory");
+    return -1;
+  }
+  sig->num_replicas = num_nodes;
+
+  // anonymous mappings get no pages until they are first written
+  for (int node = 0; node < num_nodes; node++) {
+    if (!(sig->replicas[node] = map_samples(sig->num_samples, &(sig->replica_bytes)))) {
+      perror("Not enough memory");
+      free_signal_replicas(sig);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+
+void fill_signal_replica(signal* sig, int node, long start, long end) {
+  memcpy(&(sig->replicas[node][start]), &(sig->data[start]),
+         sizeof(double) * (end - start));
+}
+
+
+double* signal_replica(signal* sig, int node) {
+  if (node >= 0 && node < sig->num_replicas) {
+    return sig->replicas[node];
+  }
+  return sig->data;
+}
+
+
+static void free_signal_replicas(signal* sig) {
+  for (int node = 0; node < sig->num_replicas; node++) {
+    if (sig->replicas[node]) {
+      munmap(sig->replicas[node], sig->replica_bytes);
+    }
+  }
+  free(sig->replicas);
+  sig->replicas     = 0;
+  sig->num_replicas = 0;
+}
+
+
+// Streaming: a reader thread fills one buffer while the caller works on
+// the other
+
+#define STREAM_BUFFERS 2
+
+struct signal_stream_ {
+  int fd;
+  long block;                     // samples per buffer
+  signal_info info;
+  long left;                      // samples still to read
+  double* buffer[STREAM_BUFFERS];
+  size_t bytes[STREAM_BUFFERS];   // mapped size of each buffer
+  long count[STREAM_BUFFERS];     // samples in a full buffer, 0 = end, -1 = error
+  int full[STREAM_BUFFERS];
+  int next;                       // buffer the caller gets next
+  int held;                       // buffer the caller has, -1 if none
+  int stop;
+  int started;                    // reader thread running
+  pthread_t reader;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+};
+
+static void* stream_reader(void* arg) {
+  signal_stream* s = (signal_stream*)arg;
+
+  for (int b = 0; ; b = (b + 1) % STREAM_BUFFERS) {
+    pthread_mutex_lock(&s->lock);
+    while (s->full[b] && !s->stop) {
+      pthread_cond_wait(&s->changed, &s->lock);
+    }
+    int stop = s->stop;
+    pthread_mutex_unlock(&s->lock);
+    if (stop) {
+      break;
+    }
+
+    // fill it, possibly with several reads; narrower samples go at the
+    // end of the buffer and are widened
+    long want    = s->left < s->block ? s->left : s->block;
+    size_t width = sample_bytes(s->info.sample_type);
+    size_t left  = want * width;
+    char* first  = (char*)(s->buffer[b]) + (sizeof(double) - width) * want;
+    char* cur    = first;
+    ssize_t thisread = 0;
+    while (left > 0 && (thisread = read(s->fd, cur, left)) > 0) {
+      cur  += thisread;
+      left -= thisread;
+    }
+    long count = (cur - first) / width;
+    if (thisread < 0 || count < want) {
+      count = -1; // the header said there was more
+    } else {
+      widen_samples(s->buffer[b], count, s->info.sample_type, s->info.scale);
+      s->left -= count;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->count[b] = count;
+    s->full[b]  = 1;
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+
+    if (s->count[b] <= 0) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+signal_stream* open_signal_stream(char* file, long block) {
+
+  signal_stream* s = (signal_stream*)calloc(1, sizeof(signal_stream));
+  if (!s) {
+    perror("Not enough memory");
+    return 0;
+  }
+  s->block = block;
+  s->held  = -1;
+
+  if ((s->fd = open(file, O_RDONLY)) < 0) {
+    perror("Cannot open file");
+    free(s);
+    return 0;
+  }
+  if (read_info_fd(s->fd, file, &s->info)) {
+    close(s->fd);
+    free(s);
+    return 0;
+  }
+  s->left = s->info.num_samples;
+  posix_fadvise(s->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  lseek(s->fd, s->info.data_offset, SEEK_SET);
+
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->changed, NULL);
+
+  for (int b = 0; b < STREAM_BUFFERS; b++) {
+    if (!(s->buffer[b] = map_samples(block, &(s->bytes[b])))) {
+      perror("Not enough memory");
+      close_signal_stream(s);
+      return 0;
+    }
+  }
+
+  if (pthread_create(&s->reader, NULL, stream_reader, s)) {
+    perror("failed to start reader thread");
+    close_signal_stream(s);
+    return 0;
+  }
+  s->started = 1;
+  return s;
+}
+
+long read_signal_stream(signal_stream* s, double** block) {
+
+  pthread_mutex_lock(&s->lock);
+
+  // done with the previous buffer, the reader may refill it
+  if (s->held >= 0) {
+    s->full[s->held] = 0;
+    s->held = -1;
+    pthread_cond_broadcast(&s->changed);
+  }
+
+  int b = s->next;
+  while (!s->full[b]) {
+    pthread_cond_wait(&s->changed, &s->lock);
+  }
+  long count = s->count[b];
+  if (count > 0) {
+    *block  = s->buffer[b];
+    s->held = b;
+    s->next = (b + 1) % STREAM_BUFFERS;
+  }
+
+  pthread_mutex_unlock(&s->lock);
+
+  if (count < 0) {
+    perror("Read failure");
+  }
+  return count;
+}
+
+void close_signal_stream(signal_stream* s) {
+  if (!s) {
+    return;
+  }
+
+  if (s->started) {
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->reader, NULL);
+  }
+
+  pthread_cond_destroy(&s->changed);
+  pthread_mutex_destroy(&s->lock);
+  for (int b = 0; b < STREAM_BUFFERS; b++) {
+    if (s->buffer[b]) {
+      munmap(s->buffer[b], s->bytes[b]);
+    }
+  }
+  close(s->fd);
+  free(s);
+}
@@ -1,24 +1,150 @@
 #ifndef __signal
 #define __signal
 
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary formats
+//
+// Raw (v1): native doubles and nothing else. The sample rate has to come
+// from somewhere else, and a short file just looks like fewer samples.
+//
+// v2: a SIGNAL_HEADER_BYTES header, then the samples. The header holds the
+// sample type, sample rate, sample count, a checksum of the data and,
+// optionally, summaries of up to SIGNAL_MAX_CHUNKS equal chunks of the
+// signal. The data starts on a page boundary, so it can be mapped or read
+// with O_DIRECT straight from the file.
+#define SIGNAL_MAGIC        "SETISIG" // first 8 bytes of a v2 file
+#define SIGNAL_HEADER_BYTES 4096
+#define SIGNAL_MAX_CHUNKS   120
+
+#define SIGNAL_SAMPLE_F64 0 // double
+#define SIGNAL_SAMPLE_F32 1 // float
+#define SIGNAL_SAMPLE_I16 2 // int16_t, value = scale * stored
+
+typedef struct signal_chunk_ {
+  double min;
+  double max;
+  double sum;
+  double sum_squares;
+} signal_chunk;
+
+typedef struct signal_info_ {
+  int version;          // 1 = raw, 2 = with header
+  int sample_type;      // SIGNAL_SAMPLE_*, always F64 for raw
+  double Fs;            // 0 if not known
+  double scale;         // for SIGNAL_SAMPLE_I16
+  long num_samples;
+  long data_offset;     // bytes from the start of the file
+  uint64_t checksum;    // of the stored data
+  long chunk_samples;   // samples per summary chunk (the last may be short)
+  int num_chunks;       // 0 if there are no summaries
+  signal_chunk chunks[SIGNAL_MAX_CHUNKS];
+} signal_info;
+
 typedef struct _signal {
   int map_fd;            // >=0 => fd of mapped file
-  int num_samples;       // number of samples
+  long num_samples;      // number of samples
   double Fs;            // sample rate
-  double* data;         // loaded or mapped data
+  int sample_type;      // SIGNAL_SAMPLE_*, which of the below has the samples
+  double* data;         // loaded or mapped data (F64, else 0)
+  float* data_f32;      // F32 samples, value = data_f32[i] - offset
+  int16_t* data_i16;    // I16 samples, value = scale * data_i16[i] - offset
+  double scale;
+  double offset;        // DC taken off, for samples it can't be taken off in place
+  size_t data_bytes;    // >0 => data is an anonymous mapping of this size
+  int num_replicas;     // NUMA node copies of data, 0 if none
+  double** replicas;    // replicas[node], see allocate_signal_replicas()
+  size_t replica_bytes; // mapped size of each replica
+  signal_info* info;    // header of the v2 file it came from, 0 otherwise
 } signal;
 
-signal* allocate_signal(int numsamples, double Fs, int for_mapping);
+signal* allocate_signal(long numsamples, double Fs, int for_mapping);
 void    free_signal(signal* sig);
 
+// Narrow samples
+// Loading and mapping keep a v2 file's f32 or i16 samples as they are, and
+// the scanners pick the float or fixed point kernels by sample_type. With
+// this off (default on) they are widened to doubles as they are loaded.
+void    set_signal_native_samples(int keep);
+
+// Turns sig's samples into doubles (with the offset taken off), for code
+// that only works on data. Returns 0 on success, -1 if out of memory
+int     widen_signal(signal* sig);
+
+// Mean and average power (mean taken off) of the samples, of any type
+int     signal_stats(signal* sig, double* mean, double* power);
+
+// Takes dc off every sample (into offset for i16)
+void    remove_signal_dc(signal* sig, double dc);
+
+// Huge pages for sample buffers
+// Full-signal sweeps touch every page, so with 4 KB pages TLB misses add
+// up quickly on long recordings. Applies to buffers allocated after the call.
+#define SIGNAL_HUGEPAGES_NONE 0 // plain malloc
+#define SIGNAL_HUGEPAGES_THP  1 // transparent huge pages, madvise(MADV_HUGEPAGE) (default)
+#define SIGNAL_HUGEPAGES_2MB  2 // MAP_HUGETLB from the reserved 2 MB pool, else THP
+#define SIGNAL_HUGEPAGES_1GB  3 // MAP_HUGETLB from the reserved 1 GB pool, else THP
+
+void    set_signal_hugepages(int mode);
+
 signal* load_text_format_signal(char* file);
 int     save_text_format_signal(char* file, signal* sig);
 
+// Raw or v2, told apart by the magic. Loading checks the data checksum of
+// a v2 file and sets Fs from its header. Both fail on a v2 file shorter
+// than its header says. Saving needs double samples.
 signal* load_binary_format_signal(char* file);
-int     save_binary_format_signal(char* file, signal* sig);
+int     save_binary_format_signal(char* file, signal* sig); // raw
 
 signal* map_binary_format_signal(char* file);
 int     unmap_binary_format_signal(signal* sig);
 
+// Writes sig as a v2 file of sample_type (SIGNAL_SAMPLE_*) with summaries
+int     save_v2_format_signal(char* file, signal* sig, int sample_type);
+
+// Fills info from file's header (or its size, for a raw file)
+// Returns 0 on success, -1 if the file can't be read, has a bad header or
+// is truncated
+int     read_signal_info(char* file, signal_info* info);
+
+// Mean and average power of the samples from the v2 summaries, without a
+// pass over the data. Returns -1 if sig has no summaries
+int     signal_summary_stats(signal* sig, double* mean, double* power);
+
+// NUMA placement of the samples
+// Loading fills data from one thread, so all of its pages land on that
+// thread's node. Either spread the pages over every node, or give each
+// node its own copy.
+#define SIGNAL_NUMA_NONE       0
+#define SIGNAL_NUMA_INTERLEAVE 1 // data's pages round robin over all nodes
+#define SIGNAL_NUMA_REPLICATE  2 // one copy of data per node
+
+// Moves data's pages round robin over all nodes (mbind MPOL_INTERLEAVE)
+// Returns 0 on success, -1 if the kernel refused
+int     interleave_signal(signal* sig);
+
+// Reserves num_nodes replicas without touching their pages, so each page
+// is placed on the node of the thread that first writes it. Fill replica
+// node with fill_signal_replica() from threads running on that node.
+// Double samples only.
+int     allocate_signal_replicas(signal* sig, int num_nodes);
+void    fill_signal_replica(signal* sig, int node, long start, long end);
+
+// Node's copy of the samples, or data if there are no replicas
+double* signal_replica(signal* sig, int node);
+
+// Reading a binary format signal (raw or v2) a block at a time, for signals too big
+// to load. A reader thread fills the next block while the caller works on
+// the current one, so at most two blocks are in memory.
+typedef struct signal_stream_ signal_stream;
+
+signal_stream* open_signal_stream(char* file, long block);
+// Points *block at the next samples, valid until the next call. Returns
+// how many (at most block), 0 at the end of the file, -1 on a read error
+// or a truncated v2 file
+long           read_signal_stream(signal_stream* stream, double** block);
+void           close_signal_stream(signal_stream* stream);
+
 #endif
 